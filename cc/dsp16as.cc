@@ -248,6 +248,10 @@ int assemble( ifstream& fin, Bin& bin ) {
                 BAD_LINE( cache.get_msg() )
             continue;
         }
+        if( strncmp(line,"dw ",3)==0 ) { // raw instruction or data word
+            cache.push( strtol(line+3,NULL,0)&0xffff );
+            continue;
+        }
         if( strncmp(line,"redo ",5)==0 ) {
             aux=strtol(line+5,NULL,0);
             if(aux<2 || aux>127) BAD_LINE("1<K<128 for redo K")
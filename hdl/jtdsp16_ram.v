@@ -31,7 +31,12 @@ module jtdsp16_ram(
     `endif
 );
 
+`ifdef JTDSP16_DEBUG
+// public so the simulation can load the RAM directly
+reg [15:0] ram[0:2047] /*verilator public*/;
+`else
 reg [15:0] ram[0:2047];
+`endif
 
 always @(posedge clk) begin
     `ifdef JTDSP16_DEBUG
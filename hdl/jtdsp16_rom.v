@@ -97,7 +97,12 @@ module jtdsp16_dualport(
 
 parameter MSB=0;
 
+`ifdef JTDSP16_DEBUG
+// public so the simulation can load the ROM directly
+reg  [ 7:0] mem[0:4095] /*verilator public*/;
+`else
 reg  [ 7:0] mem[0:4095];
+`endif
 
 `ifdef JTDSP16_FWLOAD
 initial begin
@@ -0,0 +1,545 @@
+#ifndef __DSP16BATCH_H
+#define __DSP16BATCH_H
+
+#include "DSP16emu.h"
+#include <vector>
+
+// Several emulators running the same firmware in lockstep, e.g. one per
+// song. Lanes at the same program point (PC, cache loop, interrupt shadow
+// and cycle count) form a group. Each instruction is decoded once for the
+// group, and the DAU registers and accumulators of its lanes are kept as
+// arrays indexed by slot, so the F1 functions and the 16x16 product are
+// loops over the lanes that the compiler can vectorise. The pointer
+// registers, the RAM and the peripherals stay in the DSP16emu of each
+// lane, as RAM accesses are per lane anyway.
+//
+// The F1 instructions with a Y or pt operand, the short immediates and
+// goto JA run for the whole group. Any other instruction runs on each
+// lane's DSP16emu, and the lanes at the most common program point after
+// it go on together. A lane that has an interrupt pending or stops on
+// an event leaves the group and runs alone up to the end of run_until.
+// Groups are made again in each run_until. Every lane gets the same
+// results as DSP16emu::run_until
+
+// Program point shared by the lanes of a group
+struct DSP16ctl {
+    int  pc, pi, next_pi;
+    bool shadow, branch_ok, in_cache, cache_first;
+    int  cache_start, cache_end, cache_left, cache_exit;
+    int  auc;       // AUC mode of all the lanes
+    int  stop_pc;
+    int  cycles;    // cycles used in this run_until
+    int64_t ticks;
+};
+
+class DSP16batch {
+    DSP16code *code;
+    int16_t   *ram;
+    std::vector<DSP16emu*> lanes;
+    // DAU state of the lanes in the group, by slot
+    std::vector<int>     x, y, yl, p, psw, next_x, next_y, next_yl, next_p, next_psw;
+    std::vector<int64_t> a0, a1, next_a0, next_a1, flag_r, next_flag_r;
+    std::vector<uint8_t> flags_pending, next_flags_pending;
+    std::vector<int>     v;         // operand of each slot
+    std::vector<int>     slot_lane;
+    int  m;                         // lanes in the group
+    bool fresh;                     // lanes joined since the last commit
+    DSP16ctl ctl;
+    static const int GROUP_MIN = 2;
+
+    DSP16emu& lane( int s ) { return *lanes[ slot_lane[s] ]; }
+    static bool groupable( const DSP16emu& e ) {
+        return !e.verbose && e.cov==nullptr && !(e.irq|e.irq_latch|e.clr_iack) && e.pc<=0xfff;
+    }
+    static bool grouped_op( int opcode );
+    bool same_point( const DSP16emu& e, int cycles ) const;
+    void make_group( std::vector<int>& cand, EmuRun* runs, int budget );
+    void join( int k, int cycles );
+    void leave( int s, EmuRun* runs );
+    bool stopped( DSP16emu& e ) {
+        if( ctl.pc==e.stop_pc ) e.events |= EVENT_BREAK;
+        return (e.events & e.stop_mask)!=0;
+    }
+    bool process_do();
+    void commit();
+    void step( const DSP16op& d, EmuRun* runs, int budget );
+    void solo_step( EmuRun* runs, int budget );
+    int  get_acc( int s, int w, bool high, bool sat ) const;
+    void assign_acc( int aD, int selhigh );
+    template<int F> void F1( int f, bool up_now );
+    static void (DSP16batch::* const f1_table[16])( int, bool );
+public:
+    int64_t steps, lane_steps;      // instructions run for a whole group, and for each lane in it
+    DSP16batch( int16_t* rom, int n, DSP16engine engine=ENGINE_SWITCH );
+    ~DSP16batch();
+    int size() const { return lanes.size(); }
+    DSP16emu& operator[]( int k ) { return *lanes[k]; }
+    // DSP16emu::run_until on every lane. runs must have room for size() results
+    void run_until( int budget, int event_mask, EmuRun* runs );
+};
+
+DSP16batch::DSP16batch( int16_t* rom, int n, DSP16engine engine ) {
+    code = new DSP16code;
+    DSP16emu::predecode( *code, rom );
+    ram = new int16_t[ 2048*n ];
+    for( int k=0; k<n; k++ )
+        lanes.push_back( new DSP16emu( code, ram+2048*k, engine ) );
+    for( auto w : { &x, &y, &yl, &p, &psw, &next_x, &next_y, &next_yl, &next_p, &next_psw, &v, &slot_lane } )
+        w->resize( n );
+    for( auto w : { &a0, &a1, &next_a0, &next_a1, &flag_r, &next_flag_r } )
+        w->resize( n );
+    flags_pending.resize( n );
+    next_flags_pending.resize( n );
+    m = 0;
+    fresh = false;
+    steps = lane_steps = 0;
+}
+
+DSP16batch::~DSP16batch() {
+    for( auto e : lanes ) delete e;
+    delete[] ram;
+    delete code;
+}
+
+bool DSP16batch::grouped_op( int opcode ) {
+    switch( opcode ) {
+        case 0: case 1: case 2: case 3: case 4: case 6: case 7:
+        case 20: case 22: case 23: case 25: case 27: case 28: case 31:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool DSP16batch::same_point( const DSP16emu& e, int cycles ) const {
+    return e.pc==ctl.pc && e.pi==ctl.pi && e.next_pi==ctl.next_pi &&
+        e.shadow==ctl.shadow && e.branch_ok==ctl.branch_ok &&
+        e.in_cache==ctl.in_cache && e.cache_first==ctl.cache_first &&
+        e.cache_start==ctl.cache_start && e.cache_end==ctl.cache_end &&
+        e.cache_left==ctl.cache_left && e.cache_exit==ctl.cache_exit &&
+        (e.next_auc&0x7f)==ctl.auc && e.stop_pc==ctl.stop_pc &&
+        e.ticks==ctl.ticks && cycles==ctl.cycles;
+}
+
+// Lanes that are done are left out. The lanes at the most common program
+// point join the group and the others run alone
+void DSP16batch::make_group( std::vector<int>& cand, EmuRun* runs, int budget ) {
+    std::vector<int> rest;
+    for( int k : cand ) {
+        DSP16emu& e = *lanes[k];
+        if( runs[k].cycles>=budget || e.stopped() ) continue;
+        if( groupable( e ) )
+            rest.push_back( k );
+        else
+            runs[k].cycles = e.run_rest( runs[k].cycles, budget );
+    }
+    int lead=-1, best=0;
+    for( size_t a=0; a<rest.size() && best*2<(int)rest.size(); a++ ) {
+        join( rest[a], runs[rest[a]].cycles ); // only sets ctl
+        m = 0;
+        int n=0;
+        for( int k : rest ) n += same_point( *lanes[k], runs[k].cycles );
+        if( n>best ) {
+            best = n;
+            lead = rest[a];
+        }
+    }
+    if( best>=GROUP_MIN ) join( lead, runs[lead].cycles );
+    for( int k : rest ) {
+        if( m>0 && k!=lead && same_point( *lanes[k], runs[k].cycles ) )
+            join( k, runs[k].cycles );
+        else if( m==0 || k!=lead )
+            runs[k].cycles = lanes[k]->run_rest( runs[k].cycles, budget );
+    }
+}
+
+// The first lane of a group sets the program point
+void DSP16batch::join( int k, int cycles ) {
+    DSP16emu& e = *lanes[k];
+    if( m==0 ) {
+        ctl.pc = e.pc;
+        ctl.pi = e.pi;
+        ctl.next_pi = e.next_pi;
+        ctl.shadow = e.shadow;
+        ctl.branch_ok = e.branch_ok;
+        ctl.in_cache = e.in_cache;
+        ctl.cache_first = e.cache_first;
+        ctl.cache_start = e.cache_start;
+        ctl.cache_end = e.cache_end;
+        ctl.cache_left = e.cache_left;
+        ctl.cache_exit = e.cache_exit;
+        ctl.auc = e.next_auc&0x7f;
+        ctl.stop_pc = e.stop_pc;
+        ctl.cycles = cycles;
+        ctl.ticks = e.ticks;
+    }
+    int s = m++;
+    slot_lane[s] = k;
+    x[s] = e.x;
+    y[s] = e.y;
+    yl[s] = e.yl;
+    p[s] = e.p;
+    psw[s] = e.psw;
+    next_x[s] = e.next_x;
+    next_y[s] = e.next_y;
+    next_yl[s] = e.next_yl;
+    next_p[s] = e.next_p;
+    next_psw[s] = e.next_psw;
+    a0[s] = e.a0;
+    a1[s] = e.a1;
+    next_a0[s] = e.next_a0;
+    next_a1[s] = e.next_a1;
+    flag_r[s] = e.flag_r;
+    next_flag_r[s] = e.next_flag_r;
+    flags_pending[s] = e.flags_pending;
+    next_flags_pending[s] = e.next_flags_pending;
+    fresh = true;
+}
+
+// The last slot moves into the place of the one that leaves
+void DSP16batch::leave( int s, EmuRun* runs ) {
+    int k = slot_lane[s];
+    DSP16emu& e = *lanes[k];
+    e.pc = ctl.pc;
+    e.pi = ctl.pi;
+    e.next_pi = ctl.next_pi;
+    e.shadow = ctl.shadow;
+    e.branch_ok = ctl.branch_ok;
+    e.in_cache = ctl.in_cache;
+    e.cache_first = ctl.cache_first;
+    e.cache_start = ctl.cache_start;
+    e.cache_end = ctl.cache_end;
+    e.cache_left = ctl.cache_left;
+    e.cache_exit = ctl.cache_exit;
+    e.ticks = ctl.ticks;
+    runs[k].cycles = ctl.cycles;
+    e.x = x[s];
+    e.y = y[s];
+    e.yl = yl[s];
+    e.p = p[s];
+    e.psw = psw[s];
+    e.next_x = next_x[s];
+    e.next_y = next_y[s];
+    e.next_yl = next_yl[s];
+    e.next_p = next_p[s];
+    e.next_psw = next_psw[s];
+    e.a0 = a0[s];
+    e.a1 = a1[s];
+    e.next_a0 = next_a0[s];
+    e.next_a1 = next_a1[s];
+    e.flag_r = flag_r[s];
+    e.next_flag_r = next_flag_r[s];
+    e.flags_pending = flags_pending[s];
+    e.next_flags_pending = next_flags_pending[s];
+    int last = --m;
+    if( s==last ) return;
+    slot_lane[s] = slot_lane[last];
+    x[s] = x[last];
+    y[s] = y[last];
+    yl[s] = yl[last];
+    p[s] = p[last];
+    psw[s] = psw[last];
+    next_x[s] = next_x[last];
+    next_y[s] = next_y[last];
+    next_yl[s] = next_yl[last];
+    next_p[s] = next_p[last];
+    next_psw[s] = next_psw[last];
+    a0[s] = a0[last];
+    a1[s] = a1[last];
+    next_a0[s] = next_a0[last];
+    next_a1[s] = next_a1[last];
+    flag_r[s] = flag_r[last];
+    next_flag_r[s] = next_flag_r[last];
+    flags_pending[s] = flags_pending[last];
+    next_flags_pending[s] = next_flags_pending[last];
+}
+
+void DSP16batch::run_until( int budget, int event_mask, EmuRun* runs ) {
+    std::vector<int> cand;
+    for( int k=0; k<size(); k++ ) {
+        DSP16emu& e = *lanes[k];
+        e.events = 0;
+        runs[k].cycles = e.eval();
+        e.stop_mask = event_mask;
+        e.stop_pc = (event_mask & EVENT_BREAK) ? e.breakpoint : -1;
+        cand.push_back( k );
+    }
+    make_group( cand, runs, budget );
+    while( m>0 ) {
+        if( ctl.pc<=0xfff && grouped_op( code->dec[ctl.pc].opcode ) )
+            step( code->dec[ctl.pc], runs, budget );
+        else
+            solo_step( runs, budget );
+    }
+    for( int k=0; k<size(); k++ ) {
+        DSP16emu& e = *lanes[k];
+        runs[k].events = e.events & event_mask;
+        e.stop_mask = 0;
+        e.stop_pc = -1;
+    }
+}
+
+// The instruction runs on the DSP16emu of each lane
+void DSP16batch::solo_step( EmuRun* runs, int budget ) {
+    std::vector<int> cand;
+    while( m>0 ) {
+        cand.push_back( slot_lane[m-1] );
+        leave( m-1, runs );
+    }
+    for( int k : cand ) runs[k].cycles += lanes[k]->eval();
+    make_group( cand, runs, budget );
+}
+
+bool DSP16batch::process_do() {
+    if( ctl.in_cache && ctl.pc>ctl.cache_end ) {
+        ctl.cache_left--;
+        if( ctl.cache_left>0 ) {
+            ctl.pc = ctl.cache_start;
+            ctl.cache_first = false;
+            return false;
+        }
+        ctl.in_cache = false;
+        ctl.pc = ctl.cache_exit;
+        return true;
+    }
+    return false;
+}
+
+// DSP16emu::update_regs for the group. Only the AAU registers can change
+// in the lanes while they are grouped, so the rest is copied once
+void DSP16batch::commit() {
+    for( int s=0; s<m; s++ ) {
+        DSP16emu& e = lane(s);
+        if( fresh ) {
+            e.update_regs(); // its DAU copy is not used while grouped
+            continue;
+        }
+        e.j  = e.next_j;
+        e.k  = e.next_k;
+        e.rb = e.next_rb;
+        e.re = e.next_re;
+        e.r0 = e.next_r0;
+        e.r1 = e.next_r1;
+        e.r2 = e.next_r2;
+        e.r3 = e.next_r3;
+        e.pt = e.next_pt;
+    }
+    fresh = false;
+    for( int s=0; s<m; s++ ) {
+        x[s]  = next_x[s];
+        y[s]  = next_y[s];
+        yl[s] = next_yl[s];
+        p[s]  = next_p[s];
+        a0[s] = next_a0[s];
+        a1[s] = next_a1[s];
+        flag_r[s] = next_flag_r[s];
+        flags_pending[s] = next_flags_pending[s];
+        int s0 = (a0[s]>>31)&0x1f;
+        int s1 = (a1[s]>>31)&0x1f;
+        int ov0 = s0!=0 && s0!=0x1f;
+        int ov1 = s1!=0 && s1!=0x1f;
+        psw[s] = (next_psw[s] & ~0x210) | (ov1<<9) | (ov0<<4);
+    }
+    ctl.pi = ctl.next_pi;
+}
+
+int DSP16batch::get_acc( int s, int w, bool high, bool sat ) const {
+    int64_t acc_mux = w ? a1[s] : a0[s];
+    if( sat && (
+        (w==1 && (psw[s]&0x200)!=0 && (ctl.auc&8)==0) ||
+        (w==0 && (psw[s]&0x010)!=0 && (ctl.auc&4)==0)    )) {
+        acc_mux = (acc_mux&(1L<<35)) ? 0x8000'0000L : 0x7FFF'FFFFL;
+    }
+    return (high ? acc_mux>>16 : acc_mux) & 0xFFFF;
+}
+
+// aT[l] = v for every slot, as DSP16emu::assign_acc
+void DSP16batch::assign_acc( int aD, int selhigh ) {
+    const int clr = (ctl.auc>>(4+aD))&1;
+    const int64_t *pr = aD ? a1.data() : a0.data();
+    int64_t *pnext = aD ? next_a1.data() : next_a0.data();
+    for( int s=0; s<m; s++ ) {
+        int64_t v64 = v[s] & 0xffff;
+        int64_t newv = pr[s];
+        if( selhigh ) {
+            v64 <<= 16;
+            newv &= 0xffffL;
+        } else {
+            newv &= ~0xffffL;
+        }
+        newv |= v64;
+        if( selhigh && ((newv>>31)&1) )
+            newv |= 0xf'0000'0000L; // sign extend
+        newv &= 0xF'FFFF'FFFFL;
+        if( !clr && selhigh ) newv &= ~0xffff; // clear low
+        pnext[s] = newv;
+    }
+}
+
+// F1 function F on every slot, as DSP16emu::F12parse. f has the aS and aD bits
+template<int F> void DSP16batch::F1( int f, bool up_now ) {
+    const int D  = (f>>5)&1;
+    const int ps = ctl.auc&3;
+    const int64_t *as = (f&0x10) ? a1.data() : a0.data();
+    int64_t *ad      = D ? a1.data() : a0.data();
+    int64_t *next_ad = D ? next_a1.data() : next_a0.data();
+    const bool no_r = F==2 || F==6 || F==10 || F==11;
+    for( int s=0; s<m; s++ ) {
+        int64_t a = as[s];
+        a |= (a>>35)<<36; // sign extend to 37 bits
+        int pre = ps==1 ? p[s]>>2 : ps==2 ? (int)((unsigned)p[s]<<2) : p[s];
+        int64_t pext = (int64_t)pre & 0x1F'FFFF'FFFF;
+        int64_t yext = (int64_t)(int16_t)y[s];
+        yext <<= 16;
+        yext |= yl[s];
+        yext &= 0x1F'FFFF'FFFFL;
+        int64_t r = ad[s];
+        switch( F ) {
+            case  0: r = pext;      break;
+            case  1: r = a + pext;  break;
+            case  3: r = a - pext;  break;
+            case  4: r = pext;      break;
+            case  5: r = a + pext;  break;
+            case  7: r = a - pext;  break;
+            case  8: r = a | yext;  break;
+            case  9: r = a ^ yext;  break;
+            case 10: r = a & yext;  break;
+            case 11: r = a - yext;  break;
+            case 12: r = yext;      break;
+            case 13: r = a + yext;  break;
+            case 14: r = a & yext;  break;
+            case 15: r = a - yext;  break;
+        }
+        if( F<4 ) next_p[s] = (int16_t)x[s] * (int16_t)y[s];
+        int ov0 = (psw[s]>>4)&1;
+        int ov1 = (psw[s]>>9)&1;
+        if( !no_r ) {
+            int sign_bits = (r>>31)&0x1F;
+            int lmv = sign_bits!=0 && sign_bits!=0x1F;
+            ov0 = D ? ov0 : lmv;
+            ov1 = D ? lmv : ov1;
+            next_ad[s] = r & 0x0F'FFFF'FFFFL;
+            if( up_now ) ad[s] = next_ad[s];
+        }
+        if( up_now ) p[s] = next_p[s];
+        if( F!=2 && F!=6 ) {
+            next_flag_r[s] = r;
+            next_flags_pending[s] = true;
+            next_psw[s] = (ov1<<9) | (ov0<<4) |
+                (int)(((next_a1[s]>>32)&0xf)<<5) | (int)((next_a0[s]>>32)&0xf);
+            if( up_now ) {
+                psw[s] = next_psw[s];
+                flag_r[s] = r;
+                flags_pending[s] = true;
+            }
+        }
+    }
+}
+
+void (DSP16batch::* const DSP16batch::f1_table[16])( int, bool ) = {
+    &DSP16batch::F1<0>,  &DSP16batch::F1<1>,  &DSP16batch::F1<2>,  &DSP16batch::F1<3>,
+    &DSP16batch::F1<4>,  &DSP16batch::F1<5>,  &DSP16batch::F1<6>,  &DSP16batch::F1<7>,
+    &DSP16batch::F1<8>,  &DSP16batch::F1<9>,  &DSP16batch::F1<10>, &DSP16batch::F1<11>,
+    &DSP16batch::F1<12>, &DSP16batch::F1<13>, &DSP16batch::F1<14>, &DSP16batch::F1<15>
+};
+
+// One instruction for the whole group, as DSP16emu::eval. Lanes that
+// stop or have an interrupt pending leave afterwards
+void DSP16batch::step( const DSP16op& d, EmuRun* runs, int budget ) {
+    ctl.pc++;
+    bool last_loop = process_do();
+    commit();
+    if( !ctl.in_cache && ctl.shadow ) ctl.next_pi = ctl.pc;
+    auto f1 = f1_table[ d.f&0xf ];
+    const bool ycl = (ctl.auc&0x40)==0;
+    switch( d.opcode ) {
+        case 0: case 1: // goto JA
+            if( !ctl.branch_ok ) {
+                ctl.branch_ok = true;
+                break;
+            }
+            ctl.pc = d.op&0xfff;
+            if( ctl.shadow ) ctl.next_pi = ctl.pi = ctl.pc;
+            break;
+        case 2: case 3: // short immediate
+            for( int s=0; s<m; s++ ) lane(s).exec_short_imm( d );
+            break;
+        case 4: case 28: // F1 Y=aT[l]
+            for( int s=0; s<m; s++ ) v[s] = get_acc( s, d.opcode==4, (d.op&0x10)!=0, true );
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) lane(s).Yparse_write( d.Y, v[s] );
+            commit();
+            break;
+        case 6: // F1 Y
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) lane(s).Yparse_read( d.Y, false );
+            break;
+        case 7: // F1 aT[l]=Y
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) v[s] = lane(s).Yparse_read( d.Y, false );
+            assign_acc( ((~d.op)>>10)&1, (d.op>>4)&1 );
+            break;
+        case 20: // F1 Y=y[l]
+            for( int s=0; s<m; s++ ) v[s] = ((d.op&0x10) ? y[s] : yl[s]) & 0xffff;
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) lane(s).Yparse_write( d.Y, v[s] );
+            commit();
+            break;
+        case 22: // F1 x=Y
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) next_x[s] = lane(s).Yparse_read( d.Y, false );
+            break;
+        case 23: // F1 y[l]=Y
+            (this->*f1)( d.f, false );
+            for( int s=0; s<m; s++ ) {
+                int aux = lane(s).Yparse_read( d.Y, false );
+                if( d.op&0x10 ) {
+                    next_y[s] = aux;
+                    if( ycl ) next_yl[s] = 0;
+                } else
+                    next_yl[s] = aux;
+            }
+            break;
+        case 25: case 27: // F1 y=aT x=*pt++[i]
+            for( int s=0; s<m; s++ ) next_y[s] = get_acc( s, d.opcode==27, true, false );
+            (this->*f1)( d.f, true );
+            for( int s=0; s<m; s++ ) {
+                y[s] = next_y[s];
+                if( ycl ) next_yl[s] = yl[s] = 0;
+                x[s] = next_x[s] = lane(s).parse_pt( d.op );
+            }
+            break;
+        case 31: // F1 y=Y x=*pt++[i]
+            (this->*f1)( d.f, true );
+            for( int s=0; s<m; s++ ) {
+                DSP16emu& e = lane(s);
+                y[s] = next_y[s] = e.Yparse_read( d.Y, !ctl.in_cache );
+                if( ycl ) yl[s] = next_yl[s] = 0;
+                x[s] = next_x[s] = e.parse_pt( d.op );
+            }
+            break;
+    }
+    int delta = d.cycles;
+    if( last_loop ) {
+        delta++;
+        commit();
+    }
+    ctl.ticks  += delta;
+    ctl.cycles += delta;
+    steps++;
+    lane_steps += m;
+    for( int s=m-1; s>=0; s-- ) {
+        DSP16emu& e = lane(s);
+        e.ticks = ctl.ticks;
+        if( e.ticks>=e.io_next ) e.update_io();
+        if( ctl.cycles>=budget || stopped( e ) ) {
+            leave( s, runs );
+        } else if( e.irq|e.irq_latch|e.clr_iack ) {
+            int k = slot_lane[s];
+            leave( s, runs );
+            runs[k].cycles = e.run_rest( runs[k].cycles, budget );
+        }
+    }
+}
+
+#endif
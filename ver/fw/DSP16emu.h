@@ -1,23 +1,246 @@
+#ifndef __DSP16EMU_H
+#define __DSP16EMU_H
+
+#include "snapshot.h"
+#include <algorithm>
+#include <vector>
+
 struct EmuStats {
     int ram_reads, ram_writes;
 };
 
+// Events that can stop DSP16emu::run_until
+const int EVENT_PODS   = 1;     // pdx0/pdx1 written
+const int EVENT_PIDS   = 2;     // pdx0/pdx1 read
+const int EVENT_SIO    = 4;     // a word started to shift out of the serial port
+const int EVENT_IACK   = 8;     // interrupt acknowledged
+const int EVENT_EXTROM = 0x10;  // external ROM read through pt
+const int EVENT_BREAK  = 0x20;  // pc reached the breakpoint
+
+struct EmuRun {
+    int events;     // events that stopped the run, zero if the budget was used up
+    int cycles;     // cycles run
+};
+
+// External devices connected to the emulator
+class DSP16io {
+public:
+    virtual int ext_read( int /*addr*/ ) { return 0; }
+    // value on the parallel bus when pdx0 (psel=0) or pdx1 (psel=1) is read.
+    // It is latched at the end of the read strobe, so the firmware gets it
+    // in the next read of that register
+    virtual int pdx_in( int /*psel*/ ) { return 0; }
+    // end of the output strobe after a pdx0 (psel=0) or pdx1 (psel=1) write
+    virtual void pdx_out( int /*psel*/, int /*data*/ ) {}
+    // a word moves from sdx to the serial shift register. addr is the
+    // srta value sent along with it
+    virtual void sio_out( int /*data*/, int /*addr*/ ) {}
+    virtual ~DSP16io() {}
+};
+
+// Serial output port, as in hdl/jtdsp16_sio.v. Only the configuration
+// used by QSound is modelled: 16-bit words, one bit every six cycles, so
+// the shift register takes a new word every 96 cycles. There is no serial
+// input, so IBF stays low
+const int SIO_WORD_CYCLES = 96;
+const int SIO_FIRST_WORD  = 92;     // ocnt reaches bit 15 at the 16th OCK rising edge
+
+struct DSP16sio {
+    int  obuf;          // output buffer, loaded through sdx
+    int  shift;         // last word moved to the shift register
+    int  addr;          // srta sent with it
+    bool obe, ose;      // output buffer and shift register empty
+    int64_t next_word;  // cycle of the next word boundary
+};
+
+// Parallel port strobes, as in hdl/jtdsp16_pio.v. PODS and PIDS stay
+// active for 1 to 4 cycles, as set by pioc bits 14-13
+const int64_t TICKS_NEVER = 0x7fff'ffff'ffff'ffffL;
+
+struct DSP16pio {
+    int64_t pods_end, pids_end;     // end of the active strobe, TICKS_NEVER if idle
+};
+
 const int RFIELD_Y  = 0x11;
 const int RFIELD_YL = 0x12;
+const int RFIELD_PSW= 0x14;
+
+class DSP16emu;
+struct DSP16op;
+
+typedef void (DSP16emu::*OpHandler)( const DSP16op& );
+struct DSP16uop;
+typedef void (DSP16emu::*UopHandler)( const DSP16uop& );
+typedef void (DSP16emu::*F1Handler)( bool up_now );
+typedef int  (DSP16emu::*YHandler)( bool up_now );
+
+// Execution engines. Both produce the same results
+enum DSP16engine {
+    ENGINE_SWITCH,      // a switch on the T field for each instruction
+    ENGINE_THREADED,    // handlers dispatch the next instruction directly
+    ENGINE_BLOCK        // run_until runs translated basic blocks. eval() works as in ENGINE_SWITCH
+};
+
+// Instruction fields extracted from a ROM word. The ROM does not change during
+// a simulation, so each word is decoded once when the ROM is set
+struct DSP16op {
+    OpHandler handler;
+    uint16_t op;      // raw instruction word
+    uint8_t  opcode;  // T field
+    uint8_t  r;       // R field
+    uint8_t  Y;       // Y field
+    uint8_t  f;       // F1/F2 function, including the aS/aD bits
+    uint8_t  con;     // CON field
+    uint8_t  cycles;  // cycle count outside the cache
+};
+
+// Pre-decoded ROM. Emulators running the same firmware can share it
+struct DSP16code {
+    int16_t *rom;
+    DSP16op  dec[4*1024];
+    DSP16op  ext;       // instruction read outside the internal ROM
+};
+
+// Translated basic block: a straight run of instructions ending at the
+// first one that can change the program flow or the AUC mode
+const int BLOCK_MAX = 32;
+const int BLOCK_MODES = 4;  // AUC modes kept per PC. Older ones are retranslated
+
+// Translated instruction. The handler and its operands are picked when the
+// block is made, for the instruction fields and the AUC mode of the block
+struct DSP16uop {
+    UopHandler run;
+    const DSP16op* d;
+    F1Handler f1;           // F1 function, with aS, aD and the p alignment fixed
+    YHandler  yaddr;        // Y field, with the pointer register and its step fixed
+    int DSP16emu::*sreg;    // short immediate destination and value
+    int  imm;
+    bool ycl;               // y writes clear yl (AUC bit 6 low)
+    bool flags;             // false if the flags are overwritten before being read
+    bool mul;               // false if the product is overwritten before being read
+    int  fwindow, mwindow;  // cycles up to the instruction that overwrites them
+    int  fstops, mstops;    // run_until events that may occur before that
+};
+
+// Blocks for the same PC but other AUC modes are chained
+struct DSP16block {
+    int auc;
+    int len;
+    DSP16block *next;
+    DSP16uop ops[BLOCK_MAX];
+};
+
+// Instruction coverage. Each cell is an opcode together with the fields
+// that change how it runs: the F1/F2 function, the Y post-modification,
+// CON and the AUC alignment and saturation bits. Fields that an opcode
+// does not use are left at zero, so they do not add cells
+const int COV_CELLS = 1<<20;
+
+struct DSP16cov {
+    std::vector<uint8_t> cells;
+    DSP16cov() : cells(COV_CELLS) {}
+    static int key( int op, int auc );
+    void hit( int op, int auc ) { cells[ key(op,auc) ] = 1; }
+    bool covered( int op, int auc ) const { return cells[ key(op,auc) ]!=0; }
+    void merge( const DSP16cov& o ) {
+        for( int k=0; k<COV_CELLS; k++ ) cells[k] |= o.cells[k];
+    }
+    int count() const;
+};
+
+int DSP16cov::key( int op, int auc ) {
+    int t = (op>>11)&0x1f;
+    int f=0, y=0, con=0, a=0;
+    switch( t ) {
+        case 4: case 6: case 7: case 20: case 21: case 22: case 23:
+        case 25: case 27: case 28: case 31: // F1
+            f = (op>>5)&0xf;
+            y = op&3;
+            a = auc&0xf;
+            break;
+        case 9: case 11: // R=aS, only saturation applies
+            a = auc&0xc;
+            break;
+        case 12: case 15: // Y=R, R=Y
+            y = op&3;
+            break;
+        case 19: // if CON F2
+            f = (op>>5)&0xf;
+            con = op&0x1f;
+            a = auc&0xf;
+            break;
+        case 26: // if CON goto
+            con = op&0x1f;
+            break;
+    }
+    return (t<<15) | (f<<11) | (y<<9) | (con<<4) | a;
+}
+
+int DSP16cov::count() const {
+    int n=0;
+    for( auto c : cells ) n += c;
+    return n;
+}
 
 class DSP16emu {
+    friend class DSP16batch;
     int16_t *rom, *ram;
+    DSP16code *code;
+    bool    own_code, own_ram;
     int16_t read_rom(int a);
+    static void decode( DSP16op& d, int op );
+    const DSP16op& fetch( int a ) { return a>0xfff ? code->ext : code->dec[a]; }
+    void    init( DSP16engine _engine );
+    void    reset_state();
+    DSP16engine engine;
+    static const OpHandler handlers[32];
+    // Block translation
+    DSP16block **blocks;
+    bool flags_live, mul_live;
+    DSP16block *translate( int a, int mode );
+    void    flush_blocks();
+    bool    may_end( int window, int stops, int total, int budget ) const {
+        return (stops & stop_mask)!=0 || ticks+window>=io_next || total+window>=budget || stop_pc>=0;
+    }
+    static const F1Handler f1_spec[3][64];
+    static const YHandler  y_spec[16];
+    template<int F, int S, int D, int PS> void F1_spec( bool up_now );
+    template<int R, int STEP> int Y_spec( bool up_now );
     int next_j, next_k, next_rb, next_re, next_r0, next_r1, next_r2, next_r3;
     int next_pt, next_pr, next_pi, next_i;
     int next_x,  next_y,  next_yl, next_p;
     int next_auc, next_psw, next_c0, next_c1, next_c2, next_sioc, next_srta, next_sdx;
     int next_tdms, next_pioc, next_pdx0, next_pdx1, next_pbus;
+    int pdx0_in, pdx1_in;   // PIO input latches
     int lfsr;
+    // Interrupts. The INT pin goes through a latch in the PIO, which is
+    // set on the rising edge of irq when pioc bit 5 is set and cleared when
+    // iack goes down. pi stops following the PC (shadow) inside the service
+    // routine, so ireturn goes back to the interrupted instruction
+    int  irq_latch, last_irq, clr_iack;
+    bool shadow;
+    bool branch_ok;     // false after an if CON instruction whose condition failed
+    int  check_irq();
+    // Peripherals are updated once the cycle count reaches io_next
+    int64_t io_next;
+    void add_ticks( int c ) {
+        ticks += c;
+        if( ticks>=io_next ) update_io();
+    }
+    void update_io();
+    void sio_word_boundary();
+    void schedule_io() { io_next = std::min( sio.next_word, std::min( pio.pods_end, pio.pids_end ) ); }
+    int  strobe_cycles() const { return ((pioc>>13)&3)+1; }
     int64_t next_a0, next_a1;
+    // PSW flags are only worked out from the last ALU result when read
+    int psw;
+    int64_t flag_r, next_flag_r;
+    bool flags_pending, next_flags_pending;
+    int     flag_bits( int64_t r );
     // Cache
     bool in_cache,cache_first;
     int  cache_start, cache_end, cache_left;
+    int  cache_exit;    // next PC after the loop. A redo goes back to the instruction after it
 
     void    update_regs();
     void    update_overflow();
@@ -26,19 +249,19 @@ class DSP16emu {
     int64_t assign_high( int clr_mask, int64_t& dest, int val );
     int     sign_extend( int v, int msb=7 );
     void    disasm(int op);
-    const char *disasm_r( int op );
+    static const char *disasm_r( int op );
 
     int     Yparse( int Y, bool up_now );
     void    Yparse_write( int Y, int v );
     int     Yparse_read( int Y, bool up_now=true );
 
-    void    F1parse( int op, bool up_now=false ) { F12parse( op, false, up_now); }
-    void    F2parse( int op, bool up_now=false ) { F12parse( op, true, up_now); }
-    void    F12parse( int op, bool special, bool up_now=false );
+    void    F1parse( int f, bool up_now=false ) { F12parse( f, false, up_now); }
+    void    F2parse( int f, bool up_now=false ) { F12parse( f, true, up_now); }
+    void    F12parse( int f, bool special, bool up_now=false );
     int     parse_pt( int op );
     void    parseZ( int op );
-    void    set_psw( int lmi, int leq, int llv, int lmv, int ov0, int ov1, bool up_now );
-    bool    CONparse( int op );
+    void    set_psw( int64_t r, int ov0, int ov1, bool up_now );
+    bool    CONparse( int con );
     bool    processDo();
 
     int64_t extend_p();
@@ -54,31 +277,151 @@ class DSP16emu {
     int     ram_read( int a );
 
     bool    next_lfsr();
+
+    const DSP16op& fetch_next( bool& last_loop );
+    int     retire( const DSP16op& d, bool last_loop );
+    int     eval_threaded( int n, int budget=0x7fff'ffff );
+    // run_until control
+    int     run_rest( int cycles, int budget );
+    int     events, stop_mask, stop_pc;
+    bool    stopped() {
+        if( pc==stop_pc ) events |= EVENT_BREAK;
+        return (events & stop_mask)!=0;
+    }
+    // instruction handlers
+    void    exec_goto     ( const DSP16op& d );
+    void    exec_call     ( const DSP16op& d );
+    void    exec_gotoB    ( const DSP16op& d );
+    void    exec_ifc      ( const DSP16op& d );
+    void    exec_short_imm( const DSP16op& d );
+    void    exec_aTY      ( const DSP16op& d );
+    void    exec_aTR      ( const DSP16op& d );
+    void    exec_Ra0      ( const DSP16op& d );
+    void    exec_Ra1      ( const DSP16op& d );
+    void    exec_long_imm ( const DSP16op& d );
+    void    exec_YR       ( const DSP16op& d );
+    void    exec_do       ( const DSP16op& d );
+    void    exec_RY       ( const DSP16op& d );
+    void    exec_if_F2    ( const DSP16op& d );
+    void    exec_Yy       ( const DSP16op& d );
+    void    exec_Zy       ( const DSP16op& d );
+    void    exec_xY       ( const DSP16op& d );
+    void    exec_yY       ( const DSP16op& d );
+    void    exec_ya_xX    ( const DSP16op& d );
+    void    exec_yY_xX    ( const DSP16op& d );
+    void    exec_Ya       ( const DSP16op& d );
+    void    exec_Y        ( const DSP16op& d );
+    void    exec_none     ( const DSP16op& d );
+    // translated instruction handlers
+    void    uop_generic   ( const DSP16uop& u );
+    void    uop_short     ( const DSP16uop& u );
+    void    uop_Y         ( const DSP16uop& u );
+    void    uop_aTY       ( const DSP16uop& u );
+    void    uop_xY        ( const DSP16uop& u );
+    void    uop_yY        ( const DSP16uop& u );
+    void    uop_Ya        ( const DSP16uop& u );
+    void    uop_Yy        ( const DSP16uop& u );
+    void    uop_Zy        ( const DSP16uop& u );
+    void    uop_ya_xX     ( const DSP16uop& u );
+    void    uop_yY_xX     ( const DSP16uop& u );
 public:
     int pc, j, k, rb, re, r0, r1, r2, r3;
     int pt, pr, pi, i;
     int x, y, yl, p;
-    int auc, psw, c0, c1, c2, sioc, srta, sdx;
+    int auc, c0, c1, c2, sioc, srta, sdx;
     int tdms, pioc, pdx0, pdx1, pbus_out;
+    int psel;           // PSEL pin, bit 1 of the R field of the last pdx access
+    int irq, iack;      // interrupt pins. Use set_irq to drive irq
+    DSP16sio sio;
+    DSP16pio pio;
     int64_t a0, a1;
     bool verbose;
+    int  breakpoint;    // PC value for EVENT_BREAK, -1 if unused
+    int  ext_addr;      // address of the last external ROM read
+    DSP16io *io;
+    DSP16cov *cov;      // instruction coverage, not collected if null
 
     EmuStats stats;
 
-    int ticks;
-    DSP16emu( int16_t* _rom );
+    int64_t ticks;
+    DSP16emu( int16_t* _rom, DSP16engine _engine=ENGINE_SWITCH );
+    // shares a pre-decoded ROM and uses an external 2K-word RAM
+    DSP16emu( DSP16code* shared, int16_t* _ram, DSP16engine _engine=ENGINE_SWITCH );
     ~DSP16emu();
-    void randomize_ram();
+    void set_rom( int16_t* _rom );
+    // Starts again from the reset state with a new ROM. The RAM, the
+    // decoded ROM and the block table are reused, and so are the engine,
+    // io, cov, verbose and breakpoint settings. The RAM is cleared. A
+    // shared decoded ROM is kept if it is for the same ROM
+    void reset( int16_t* _rom );
+    static void predecode( DSP16code& c, int16_t* _rom );
+    void randomize_ram( unsigned& state );
+    // Full state snapshots. The ROM is not included
+    void save( std::ostream& os );
+    void load( std::istream& is );
     int16_t *get_ram() { return ram; }
-    int eval();
+    int get_psw();
+    int sio_word() const { return sio.shift; } // last word shifted out
+    // PIOC status bits: IBF (bit 4, copied to bit 15), OBE (bit 3) and INT (bit 0)
+    int pio_status() const { return (sio.obe?8:0) | (irq && (pioc&0x20) ? 1 : 0); }
+    static std::string disasm_text( int op );
+    void set_irq( int v ) {
+        irq = v;
+        if( !v ) last_irq = 0;
+    }
+    int eval();             // runs one instruction and returns its cycle count
+    int eval( int n );      // runs n instructions and returns the total cycle count
+    // runs until the cycle budget is used up or one of the events in the mask occurs
+    // at least one instruction is run, even if it is at the breakpoint
+    EmuRun run_until( int budget, int event_mask );
+    // runs up to the end of the current basic block, or until budget cycles are used
+    int eval_block( int budget=0x7fff'ffff );
 };
 
-void DSP16emu::randomize_ram() {
+// state is a rand_r seed, so threads can fill their RAMs independently
+void DSP16emu::randomize_ram( unsigned& state ) {
     for (int k=0; k<2048; k++ ) {
-        ram[k] = rand();
+        ram[k] = rand_r( &state );
     }
 }
 
+// Every state variable, in snapshot order. Bump SNAP_VERSION if it changes
+#define DSP16EMU_STATE(X) \
+    X(pc) X(j) X(k) X(rb) X(re) X(r0) X(r1) X(r2) X(r3) \
+    X(pt) X(pr) X(pi) X(i) X(x) X(y) X(yl) X(p) \
+    X(auc) X(psw) X(c0) X(c1) X(c2) X(sioc) X(srta) X(sdx) \
+    X(tdms) X(pioc) X(pdx0) X(pdx1) X(pbus_out) X(psel) X(a0) X(a1) \
+    X(pdx0_in) X(pdx1_in) X(irq) X(iack) X(irq_latch) X(last_irq) X(clr_iack) X(shadow) X(branch_ok) \
+    X(sio.obuf) X(sio.shift) X(sio.addr) X(sio.obe) X(sio.ose) X(sio.next_word) \
+    X(pio.pods_end) X(pio.pids_end) X(io_next) \
+    X(next_j) X(next_k) X(next_rb) X(next_re) X(next_r0) X(next_r1) X(next_r2) X(next_r3) \
+    X(next_pt) X(next_pr) X(next_pi) X(next_i) X(next_x) X(next_y) X(next_yl) X(next_p) \
+    X(next_auc) X(next_psw) X(next_c0) X(next_c1) X(next_c2) X(next_sioc) X(next_srta) X(next_sdx) \
+    X(next_tdms) X(next_pioc) X(next_pdx0) X(next_pdx1) X(next_pbus) X(next_a0) X(next_a1) \
+    X(flag_r) X(next_flag_r) X(flags_pending) X(next_flags_pending) \
+    X(lfsr) X(in_cache) X(cache_first) X(cache_start) X(cache_end) X(cache_left) X(cache_exit) \
+    X(ticks) X(ext_addr) X(stats.ram_reads) X(stats.ram_writes)
+
+const char     DSP16EMU_MAGIC[] = "DSP16EMU";
+const uint32_t DSP16EMU_SNAP_VERSION = 5;
+
+void DSP16emu::save( std::ostream& os ) {
+    SnapWriter w( os, DSP16EMU_MAGIC, DSP16EMU_SNAP_VERSION );
+    #define DSP16_PUT(a) w.put(a);
+    DSP16EMU_STATE(DSP16_PUT)
+    #undef DSP16_PUT
+    w.put_array( ram, 2048*sizeof(int16_t) );
+    if( !w.good() ) throw std::runtime_error("Cannot write the emulator snapshot");
+}
+
+void DSP16emu::load( std::istream& is ) {
+    SnapReader r( is, DSP16EMU_MAGIC, DSP16EMU_SNAP_VERSION );
+    #define DSP16_GET(a) r.get(a);
+    DSP16EMU_STATE(DSP16_GET)
+    #undef DSP16_GET
+    r.get_array( ram, 2048*sizeof(int16_t) );
+}
+
 #define LFSR_N(a) ((lfsr>>a)&1)
 
 bool DSP16emu::next_lfsr() {
@@ -90,31 +433,141 @@ bool DSP16emu::next_lfsr() {
     return r;
 }
 
-DSP16emu::DSP16emu( int16_t* _rom ) {
+DSP16emu::DSP16emu( int16_t* _rom, DSP16engine _engine ) {
+    code = nullptr;
+    own_code = false;
+    ram = new int16_t[2048];
+    own_ram = true;
+    init( _engine );
+    set_rom( _rom );
+}
+
+DSP16emu::DSP16emu( DSP16code* shared, int16_t* _ram, DSP16engine _engine ) {
+    code = shared;
+    own_code = false;
+    rom = code->rom;
+    ram = _ram;
+    own_ram = false;
+    init( _engine );
+}
+
+void DSP16emu::init( DSP16engine _engine ) {
     verbose = false;
+    engine = _engine;
+    io = nullptr;
+    cov = nullptr;
+    breakpoint = -1;
+    blocks = new DSP16block*[4*1024];
+    for(int k=0; k<4*1024; k++) blocks[k]=nullptr;
+    reset_state();
+}
+
+void DSP16emu::reset( int16_t* _rom ) {
+    reset_state();
+    if( !own_code && code!=nullptr && code->rom==_rom )
+        flush_blocks();
+    else
+        set_rom( _rom );
+}
+
+void DSP16emu::reset_state() {
+    ext_addr = 0;
+    events = stop_mask = 0;
+    stop_pc = -1;
     pc=0;
     j = k = rb = re = r0 = r1 = r2 = r3 = 0;
+    pt = pr = pi = i = 0;
+    x = y = yl = 0;
+    auc = c0 = c1 = c2 = sioc = srta = sdx = 0;
+    tdms = pdx0 = pdx1 = psel = 0;
+    pioc = next_pioc = 0x1800; // reset value in the RTL
+    pdx0_in = pdx1_in = 0;
+    irq = iack = irq_latch = last_irq = clr_iack = 0;
+    shadow = branch_ok = true;
+    sio.obuf = sio.shift = sio.addr = 0;
+    sio.obe = sio.ose = true;
+    sio.next_word = SIO_FIRST_WORD;
+    pio.pods_end = pio.pids_end = TICKS_NEVER;
+    schedule_io();
     next_j = next_k = next_rb = next_re = next_r0 = next_r1 = next_r2 = next_r3 = 0;
     next_pt  = next_pr  = next_pi = next_i = 0;
     next_x   = next_y   = next_yl = 0;
     next_auc = next_psw = next_c0 = next_c1 = next_c2 = next_sioc = next_srta = next_sdx = 0;
-    next_tdms = next_pioc = next_pdx0 = next_pdx1 = 0;
+    next_tdms = next_pdx0 = next_pdx1 = 0;
     next_a0 = a0 = next_a1 = a1 = 0;
+    psw = 0;
+    flag_r = next_flag_r = 0;
+    flags_pending = next_flags_pending = false;
     next_pbus = pbus_out = 0;
-    p = 0;
+    p = next_p = 0;
     ticks=0;
     lfsr = 0xcafe'cafe;
-    rom = _rom;
-    ram = new int16_t[2048];
+    flags_live = mul_live = true;
     for(int k=0; k<2048; k++) ram[k]=0;
     stats.ram_reads = stats.ram_writes = 0;
     // Cache
-    cache_first = in_cache = false; cache_left = cache_start = cache_end = 0;
+    cache_first = in_cache = false; cache_left = cache_start = cache_end = cache_exit = 0;
 }
 
 DSP16emu::~DSP16emu() {
-    delete[] ram;
+    if( own_ram ) delete[] ram;
     ram = nullptr;
+    if( own_code ) delete code;
+    code = nullptr;
+    flush_blocks();
+    delete[] blocks;
+    blocks = nullptr;
+}
+
+// The pre-decoded ROM is only refreshed here, so the ROM contents
+// must not be altered while the emulator runs
+void DSP16emu::set_rom( int16_t* _rom ) {
+    if( !own_code ) {
+        code = new DSP16code;
+        own_code = true;
+    }
+    predecode( *code, _rom );
+    rom = _rom;
+    flush_blocks();
+}
+
+void DSP16emu::predecode( DSP16code& c, int16_t* _rom ) {
+    c.rom = _rom;
+    for( int k=0; k<4*1024; k++ )
+        decode( c.dec[k], _rom[k] );
+    decode( c.ext, 0 ); // no external data
+}
+
+void DSP16emu::flush_blocks() {
+    for( int k=0; k<4*1024; k++ ) {
+        while( blocks[k]!=nullptr ) {
+            DSP16block *b = blocks[k];
+            blocks[k] = b->next;
+            delete b;
+        }
+    }
+}
+
+void DSP16emu::decode( DSP16op& d, int op ) {
+    op &= 0xffff;
+    d.op     = op;
+    d.handler = handlers[ (op>>11) & 0x1f ];
+    d.opcode = (op>>11) & 0x1f;
+    d.r      = (op>>4) & 0x3f;
+    d.Y      = op & 0xf;
+    d.f      = (op>>5) & 0x3f;
+    d.con    = op & 0x1f;
+    switch( d.opcode ) {
+        case 2: case 3: case 6: case 7: case 14: case 19:
+        case 22: case 23: case 26:
+            d.cycles = 1;
+            break;
+        case 0: case 1: case 4: case 8: case 9: case 10: case 11: case 12: case 15:
+        case 16: case 17: case 20: case 21: case 24: case 25: case 27: case 28: case 31:
+            d.cycles = 2;
+            break;
+        default: d.cycles = 0; // not supported
+    }
 }
 
 int DSP16emu::sign_extend( int v, int msb ) {
@@ -148,6 +601,8 @@ void DSP16emu::update_regs() {
 
     auc  = next_auc & 0x7f;
     psw  = next_psw;
+    flag_r = next_flag_r;
+    flags_pending = next_flags_pending;
     c0   = next_c0 & 0xff;
     c1   = next_c1 & 0xff;
     c2   = next_c2 & 0xff;
@@ -167,15 +622,30 @@ void DSP16emu::update_regs() {
     update_overflow();
 }
 
+// bits 35-31 must be all equal for the accumulator to fit in 32 bits
 void DSP16emu::update_overflow() {
-    if( ((a0>>32)&0xf) != (((a0>>31)&1) ? 0xf : 0) )
-        psw |= 0x10;
-    else
-        psw &= ~0x10;
-    if( ((a1>>32)&0xf) != (((a1>>31)&1) ? 0xf : 0) )
-        psw |= 0x200;
-    else
-        psw &= ~0x200;
+    int s0 = (a0>>31)&0x1f;
+    int s1 = (a1>>31)&0x1f;
+    int ov0 = s0!=0 && s0!=0x1f;
+    int ov1 = s1!=0 && s1!=0x1f;
+    psw = (psw & ~0x210) | (ov1<<9) | (ov0<<4);
+}
+
+int DSP16emu::flag_bits( int64_t r ) {
+    int leq = (r&0xF'FFFF'FFFFL) == 0;
+    int sign_bits = (r>>31)&0x1F;
+    int llv = ((r>>35)&1) != ((r>>36)&1); // number doesn't fit in 36-bit integer
+    int lmv = sign_bits!=0 && sign_bits!=0x1F; // number doesn't fit in 32-bit integer
+    int lmi = (r>>35)&1;
+    return (lmi<<15) | (leq<<14) | (llv<<13) | (lmv<<12);
+}
+
+int DSP16emu::get_psw() {
+    if( flags_pending ) {
+        psw = (psw&0x0fff) | flag_bits(flag_r);
+        flags_pending = false;
+    }
+    return psw;
 }
 
 int DSP16emu::get_register( int rfield ) {
@@ -196,17 +666,26 @@ int DSP16emu::get_register( int rfield ) {
         case 17: return y;
         case 18: return yl;
         case 19: return auc;
-        case 20: return psw;
+        case 20: return get_psw();
         case 21: return sign_extend(c0);
         case 22: return sign_extend(c1);
         case 23: return sign_extend(c2);
         case 24: return sioc;
         case 25: return srta;
-        case 26: return sdx;
+        case 26: return 0; // no serial input
         case 27: return tdms;
-        case 28: return pioc;
-        case 29: return pdx0;
-        case 30: return pdx1;
+        case 28: {
+            int st = pio_status();
+            return ((st&0x10)<<11) | (pioc&0x7fe0) | st;
+        }
+        case 29:
+        case 30: {
+            events |= EVENT_PIDS;
+            psel = rfield==30;
+            pio.pids_end = ticks+strobe_cycles();
+            schedule_io();
+            return psel ? pdx1_in : pdx0_in;
+        }
     }
     return 0;
 }
@@ -232,17 +711,24 @@ void DSP16emu::set_register( int rfield, int v ) {
             break;
         case 18: next_yl = yl = v; break;
         case 19: next_auc   = v; break;
-        case 20: next_psw   = v; break;
+        case 20: next_psw   = v; next_flags_pending = false; break;
         case 21: next_c0 = c0 = v & 0xff; break;
         case 22: next_c1 = c1 = v & 0xff; break;
         case 23: next_c2 = c2 = v & 0xff; break;
         case 24: next_sioc = sioc = v & 0x3ff; break;
         case 25: srta = next_srta = v & 0xff; break;
-        case 26: next_sdx   = v; break;
+        case 26:
+            next_sdx = sio.obuf = v;
+            sio.obe  = false;
+            break;
         case 27: next_tdms  = v; break;
-        case 28: next_pioc  = v; break;
-        case 29: next_pdx0  = v; pbus_out = next_pbus = v; break;
-        case 30: next_pdx1  = v; pbus_out = next_pbus = v; break;
+        case 28: next_pioc  = v & 0x7fe0; break;
+        case 29: next_pdx0  = v; pbus_out = next_pbus = v; psel=0; events |= EVENT_PODS; break;
+        case 30: next_pdx1  = v; pbus_out = next_pbus = v; psel=1; events |= EVENT_PODS; break;
+    }
+    if( rfield==29 || rfield==30 ) {
+        pio.pods_end = ticks+strobe_cycles()+1;
+        schedule_io();
     }
     //printf("next_pbus = %X\n", next_pbus);
 }
@@ -295,13 +781,14 @@ int DSP16emu::extend_i() {
     return iext;
 }
 
-bool DSP16emu::CONparse( int op ) {
+bool DSP16emu::CONparse( int con ) {
+    int psw = get_psw();
     bool lmi = psw&0x8000,
          leq = psw&0x4000,
          llv = psw&0x2000,
          lmv = psw&0x1000;
     bool v = false;
-    switch( (op>>1)&0xf ) {
+    switch( (con>>1)&0xf ) {
         case 0: v = lmi; break;
         case 1: v = leq; break;
         case 2: v = llv; break;
@@ -311,20 +798,19 @@ bool DSP16emu::CONparse( int op ) {
         case 6: v = (c1&0x80)==0; next_c1 = c1+1; break; // positive
         case 7: v = true; break;
         case 8: v = !lmi && !leq; break;
-        default: printf("\tCON value (%d) is out of range ********\n", op&0x1f );
+        default: printf("\tCON value (%d) is out of range ********\n", con );
     }
-    if( op&1 ) v = !v;
-    if( verbose ) printf("\tCON 0x%X = %d\n", op&0x1f, v );
+    if( con&1 ) v = !v;
+    if( verbose ) printf("\tCON 0x%X = %d\n", con, v );
     return v;
 }
 
-void DSP16emu::F12parse( int op, bool special, bool up_now ) {
+void DSP16emu::F12parse( int f, bool special, bool up_now ) {
     int64_t *ad, *next_ad, as;
     int ov0 = (psw&0x010)!=0;
     int ov1 = (psw&0x200)!=0;
     int* pov;
     int ovsat;
-    int f = (op>>5)&0x3f;
     int clr_mask;
     int64_t ahmask=0x1F'FFFF'FFFFL; // F2/9 uses this to indicate AL must be zero
     bool no_r = false;
@@ -481,20 +967,16 @@ void DSP16emu::F12parse( int op, bool special, bool up_now ) {
             }
             break;
     }
-    // update flags
-    int leq = (r&0xF'FFFF'FFFFL) == 0;
     int sign_bits = (r>>31)&0x1F;
-    int llv = ((r>>35)&1) != ((r>>36)&1); // number doesn't fit in 36-bit integer
     int lmv = sign_bits!=0 && sign_bits!=0x1F; // number doesn't fit in 32-bit integer
-    const int sign = (r>>35)&1;
-    int lmi = sign;
     // store the final value
     if( verbose ) {
         if( flag_up )
-            printf("Flags = %d%d%d%d - ", lmi, leq, llv, lmv );
+            printf("Flags = %X - ", flag_bits(r)>>12 );
         printf("OVSAT %d - a%d<-a%d (F%d=%X) - (%lX)\n",
              ovsat, (f>>5)&1, (f>>4)&1, special?2:1, f&0xf, r);
     }
+    int64_t r_flags = r;
     r &= 0x0F'FFFF'FFFFL;
     if( !no_r ) {
         *pov = lmv;
@@ -504,20 +986,23 @@ void DSP16emu::F12parse( int op, bool special, bool up_now ) {
         }
     }
     if( up_now ) p = next_p;
-    if(flag_up) set_psw( lmi, leq, llv, lmv, ov0, ov1, up_now );
+    if(flag_up && flags_live) set_psw( r_flags, ov0, ov1, up_now );
 }
 
-void DSP16emu::set_psw( int lmi, int leq, int llv, int lmv, int ov0, int ov1, bool up_now ) {
+// The flag bits are left at zero and filled in by get_psw()
+void DSP16emu::set_psw( int64_t r, int ov0, int ov1, bool up_now ) {
+    next_flag_r = r;
+    next_flags_pending = true;
     next_psw =
-          ((lmi&1)<<15) |
-          ((leq&1)<<14) |
-          ((llv&1)<<13) |
-          ((lmv&1)<<12) |
           ((ov1&1)<< 9) |
           ((ov0&1)<< 4) |
           (((next_a1>>32)&0xf)<<5) |
            ((next_a0>>32)&0xf);
-    if( up_now ) psw=next_psw;
+    if( up_now ) {
+        psw=next_psw;
+        flag_r = r;
+        flags_pending = true;
+    }
 }
 
 int DSP16emu::Yparse( int Y, bool up_now ) {
@@ -586,7 +1071,15 @@ void DSP16emu::ram_write( int a, int v ) {
 
 int DSP16emu::parse_pt( int op ) {
     const int X = (op>>4)&1;
-    int v = read_rom( pt ) & 0xffff;
+    int v;
+    if( pt>0xfff ) {
+        events  |= EVENT_EXTROM;
+        ext_addr = pt;
+        v = io ? io->ext_read( pt ) : 0;
+    } else {
+        v = rom[pt];
+    }
+    v &= 0xffff;
     if( X )
         pt = ((pt+extend_i())&0xfff) | (pt&0xf000);
     else
@@ -701,6 +1194,7 @@ bool DSP16emu::processDo() {
         } else {
             if( verbose ) printf("Cache loop end\n");
             in_cache = false;
+            pc = cache_exit;
             return true;
         }
     }
@@ -724,7 +1218,7 @@ const char *DSP16emu::disasm_r( int op ) {
         case 16: return "x";
         case 17: return "y";
         case 18: return "yl";
-        case 19: return "aux";
+        case 19: return "auc";
         case 20: return "psw";
         case 21: return "c0";
         case 22: return "c1";
@@ -741,7 +1235,12 @@ const char *DSP16emu::disasm_r( int op ) {
 }
 
 void DSP16emu::disasm(int op) {
+    puts( disasm_text(op).c_str() );
+}
+
+std::string DSP16emu::disasm_text(int op) {
     const char* s;
+    char buf[64];
     switch( (op>>11)&0x1f ) {
         case 0: case 1: s="goto JA"; break;
         case 2: case 3: s="R=M (short)"; break;
@@ -750,23 +1249,23 @@ void DSP16emu::disasm(int op) {
         case 6: s="F1 Y"; break;
         case 7:
             s=nullptr;
-            printf("F1 a%d%s=Y\n", (~op>>10)&1, ((op>>4)&1) ? "h" : "l" );
+            snprintf(buf, sizeof(buf), "F1 a%d%s=Y", (~op>>10)&1, ((op>>4)&1) ? "h" : "l" );
             break;
         case 8:
-            printf("a%d=%s\n", 1-((op>>10)&1), disasm_r(op) );
+            snprintf(buf, sizeof(buf), "a%d=%s", 1-((op>>10)&1), disasm_r(op) );
             s=nullptr;
             break;
         case 9: case 11:
-            printf("%s=a%d\n", disasm_r(op), (op>>12)&1);
+            snprintf(buf, sizeof(buf), "%s=a%d", disasm_r(op), (op>>12)&1);
             s=nullptr;
             break;
         case 10:
-            printf("%s=N (long)\n", disasm_r(op));
+            snprintf(buf, sizeof(buf), "%s=N (long)", disasm_r(op));
             s=nullptr;
             break;
-        case 12: printf("Y=%s\n", disasm_r(op)); s=nullptr; break;
+        case 12: snprintf(buf, sizeof(buf), "Y=%s", disasm_r(op)); s=nullptr; break;
         case 13: s="Z:R"; break;
-        case 14: printf("do/redo NI=%d, K=%d\n", (op>>7)&0xf, op&0x7f); s=nullptr; break;
+        case 14: snprintf(buf, sizeof(buf), "do/redo NI=%d, K=%d", (op>>7)&0xf, op&0x7f); s=nullptr; break;
         case 15: s="R=Y"; break;
         case 16: case 17: s="call JA"; break;
         case 18: s="ifc CON F2"; break;
@@ -784,7 +1283,7 @@ void DSP16emu::disasm(int op) {
         case 30: s="Reserved"; break;
         case 31: s="F1 y=Y  x=*pt++[i]"; break;
     }
-    if( s!=nullptr) puts(s);
+    return s!=nullptr ? s : buf;
 }
 
 int DSP16emu::get_acc( int w, bool high, bool sat ) {
@@ -797,194 +1296,762 @@ int DSP16emu::get_acc( int w, bool high, bool sat ) {
     return (high ? acc_mux>>16 : acc_mux) & 0xFFFF;
 }
 
-int DSP16emu::eval() {
-    int op = read_rom(pc++) &0xffff;
-    int delta=0;
-    int aux, aux2;
-    const int opcode = (op>>11) & 0x1f;
+// Instruction fetch and the state updates shared by all instructions
+const DSP16op& DSP16emu::fetch_next( bool& last_loop ) {
+    const DSP16op& d = fetch(pc++);
 
     if( verbose ) printf("*********");
-    bool last_loop = processDo();
+    last_loop = processDo();
 
     if(verbose) {
-        printf("OP=%04X (0x%X=%d) --> ",op, opcode, opcode );
-        disasm( op );
+        printf("OP=%04X (0x%X=%d) --> ",d.op, d.opcode, d.opcode );
+        disasm( d.op );
     }
     update_regs();
-    if(!in_cache) next_pi = pc;
-    switch( opcode ) {
-        case 0: // goto JA
-        case 1:
-            pc = op&0xfff;
-            next_pi = pc;
-            pi = pc;
-            delta=2;
+    if(!in_cache && shadow) next_pi = pc;
+    if( cov ) cov->hit( d.op, auc );
+    return d;
+}
+
+int DSP16emu::retire( const DSP16op& d, bool last_loop ) {
+    int delta = d.cycles;
+    if( last_loop ) {
+        if( verbose ) printf("Extra tick added for last loop\n");
+        delta++;
+        update_regs();
+    }
+    add_ticks( delta );
+    return delta;
+}
+
+void DSP16emu::exec_goto( const DSP16op& d ) { // goto JA
+    if( !branch_ok ) {
+        branch_ok = true;
+        return;
+    }
+    pc = d.op&0xfff;
+    if( !shadow ) return;
+    next_pi = pc;
+    pi = pc;
+}
+
+void DSP16emu::exec_call( const DSP16op& d ) { // call JA
+    if( !branch_ok ) {
+        branch_ok = true;
+        return;
+    }
+    next_pr = pr = pc;
+    pc = (pc&0xf000) | (d.op&0xfff);
+    if( !shadow ) return;
+    next_pi = pc;
+    pi = pc;
+}
+
+void DSP16emu::exec_gotoB( const DSP16op& d ) { // return, ireturn, goto pt, call pt
+    int b = (d.op>>8)&7;
+    if( !branch_ok && b!=1 ) { // ireturn is always executed
+        branch_ok = true;
+        return;
+    }
+    branch_ok = true;
+    switch( b ) {
+        case 0: pc = pr; break;
+        case 1: // ireturn
+            pc = pi;
+            shadow = true;
+            clr_iack = 1;
             break;
+        case 2: pc = pt; break;
+        case 3: next_pr = pr = pc; pc = pt; break;
+        default: printf("goto B with B=%d is not supported\n", b );
+    }
+    if( !shadow ) return;
+    next_pi = pc;
+    pi = pc;
+}
+
+// Conditional prefix for the next goto, call or return. The RTL does
+// not implement the software interrupt (icall) either
+void DSP16emu::exec_ifc( const DSP16op& d ) {
+    if( d.op & 0x400 ) return;
+    branch_ok = CONparse( d.con );
+}
+
+// Interrupt latch and entry, checked before each instruction. The
+// interrupt is not taken inside a cache loop or before instructions
+// that must not be split from the previous one. It returns the cycles
+// used if the interrupt starts
+int DSP16emu::check_irq() {
+    int line = irq && (pioc&0x20);
+    if( line && !last_irq ) irq_latch = 1;
+    last_irq = line;
+    int t = fetch(pc).opcode;
+    bool irq_ok = !( t<2 || t==14 || t==16 || t==17 || t==24 || t==26 );
+    if( irq_latch && !iack && !in_cache && irq_ok ) {
+        update_regs();
+        pi = next_pi = pc;
+        pc = 1;
+        shadow = false;
+        iack = 1;
+        clr_iack = 0;
+        events |= EVENT_IACK;
+        add_ticks( 2 );
+        return 2;
+    }
+    if( irq_ok && clr_iack ) { // falling edge of iack
+        iack = clr_iack = 0;
+        irq_latch = last_irq = 0;
+    }
+    return 0;
+}
+
+// Runs the peripheral events due up to the current cycle, in time order
+void DSP16emu::update_io() {
+    while( io_next<=ticks ) {
+        if( pio.pids_end==io_next ) {
+            pio.pids_end = TICKS_NEVER;
+            int v = io ? io->pdx_in(psel) : 0;
+            if( psel ) pdx1_in = v; else pdx0_in = v;
+        }
+        if( pio.pods_end==io_next ) {
+            pio.pods_end = TICKS_NEVER;
+            if( io ) io->pdx_out( psel, pbus_out );
+        }
+        if( sio.next_word==io_next ) sio_word_boundary();
+        schedule_io();
+    }
+}
+
+// The shift register takes the word in sdx if there is one. Otherwise it
+// is empty once the last bit is out
+void DSP16emu::sio_word_boundary() {
+    sio.next_word += SIO_WORD_CYCLES;
+    if( sio.obe ) {
+        sio.ose = true;
+        return;
+    }
+    sio.shift = sio.obuf;
+    sio.addr  = srta;
+    sio.obe   = true;
+    sio.ose   = false;
+    events |= EVENT_SIO;
+    if( pioc&0x200 ) irq_latch = 1; // OBE interrupt
+    if( io ) io->sio_out( sio.shift, sio.addr );
+}
+
+void DSP16emu::exec_short_imm( const DSP16op& d ) {
+    int aux = d.op & 0x1ff;
+    //printf("DEBUG = %X\n", (pc>>9)&7);
+    switch( (d.op>>9)&7 ) {
+        case 0: next_j  = aux; if(next_j&0x100) next_j |= 0xff00; break;
+        case 1: next_k  = aux; if(next_k&0x100) next_k |= 0xff00; break;
+        case 2: next_rb = aux; break;
+        case 3: next_re = aux; break;
+        case 4: next_r0 = aux; break;
+        case 5: next_r1 = aux; break;
+        case 6: next_r2 = aux; break;
+        case 7: next_r3 = aux; break;
+    }
+}
+
+void DSP16emu::exec_aTY( const DSP16op& d ) { // aT[l] = Y
+    F1parse( d.f );
+    int aux = Yparse_read( d.Y, false );
+    assign_acc( ((~d.op)>>10)&1, (d.op>>4)&1, aux, false );
+}
+
+void DSP16emu::exec_aTR( const DSP16op& d ) { // aT = R
+    int aux2 = get_register(d.r);
+    //printf("aT=R (%d)  -- op == %X\n",d.r,d.op);
+    if( (d.op>>10)&1 )
+        a0 = assign_high( 1, next_a0, aux2 ); // 1 selects a0
+    else
+        a1 = assign_high( 2, next_a1, aux2 ); // 0 selects a1
+    update_overflow();
+}
+
+void DSP16emu::exec_Ra0( const DSP16op& d ) { // R = a0
+    set_register( d.r, get_acc(0, true, d.r!=RFIELD_Y && d.r!=RFIELD_YL ) );
+}
+
+void DSP16emu::exec_Ra1( const DSP16op& d ) { // R = a1
+    set_register( d.r, get_acc(1, true, d.r!=RFIELD_Y && d.r!=RFIELD_YL ) );
+}
+
+void DSP16emu::exec_long_imm( const DSP16op& d ) {
+    int aux2 = read_rom(pc++);
+    if( shadow ) {
+        next_pi = pc;
+        pi = pc;
+    }
+    //printf("R = imm    [%X] = %X\n", d.r, aux2);
+    set_register( d.r, aux2 );
+}
+
+void DSP16emu::exec_YR( const DSP16op& d ) { // Y=R
+    int aux2 = get_register(d.r);
+    Yparse_write( d.Y, aux2 );
+    // printf("Y = R [%X] = %X\n",d.Y,aux2);
+}
+
+void DSP16emu::exec_do( const DSP16op& d ) { // Do/Redo
+    in_cache = true;
+    int aux = (d.op>>7)&0xf;
+    if( aux!=0 ) {
+        cache_start=pc;
+        cache_end=pc+aux-1; // last instruction in the loop
+        cache_exit=pc+aux;
+    } else {
+        cache_exit=pc;
+        pc = cache_start; // re-do
+    }
+    cache_first=true;
+    cache_left = d.op&0x7f;
+    if( verbose ) printf("Cache loop starts (NI=%d, loops=%d). Repeat %04X-%04X\n",
+        aux, cache_left, cache_start, cache_end );
+    update_regs();
+}
+
+void DSP16emu::exec_RY( const DSP16op& d ) { // R=Y
+    //printf("R=Y [%02X] = %X\n", d.r, d.Y);
+    //printf("next a0 = %lX\n", next_a0 );
+    set_register( d.r, Yparse_read( d.Y ) );
+}
+
+void DSP16emu::exec_if_F2( const DSP16op& d ) { // if CON F2
+    if( CONparse(d.con) ) {
+        F2parse( d.f );
+        //printf("next flags=%X\n", next_psw>>24);
+    }
+}
+
+void DSP16emu::exec_Yy( const DSP16op& d ) { // Y=y[l] F1
+    int aux2 = (d.op&0x10) ? y : yl;
+    aux2 &= 0xffff;
+    F1parse( d.f );
+    Yparse_write( d.Y, aux2 );
+    update_regs();
+}
+
+void DSP16emu::exec_Zy( const DSP16op& d ) { // Z:y F1
+    F1parse( d.f, true );
+    parseZ(d.op);
+}
+
+void DSP16emu::exec_xY( const DSP16op& d ) { // x=Y F1
+    F1parse( d.f );
+    next_x = Yparse_read( d.Y, false );
+}
+
+void DSP16emu::exec_yY( const DSP16op& d ) { // y=Y F1
+    F1parse( d.f );
+    int aux = Yparse_read( d.Y, false );
+    if( d.op&0x10 ) {
+        next_y = aux;
+        if( ((auc>>6)&1)==0 ) next_yl=0;
+    }
+    else
+        next_yl = aux;
+}
+
+void DSP16emu::exec_ya_xX( const DSP16op& d ) { // F1 y=aT x=*pt++[i]
+    //if(verbose ) printf("OP 27. as = {%X, %X}\n", aux, aux2);
+    next_y  = get_acc( d.opcode==27 ? 1 : 0, true, false );
+    F1parse( d.f, true );
+    y = next_y;
+    if( (auc&0x40)==0 )
+        next_yl = yl = 0;
+    x = next_x = parse_pt(d.op);
+    // delta = in_cache ? 1 : 2;
+}
+
+void DSP16emu::exec_yY_xX( const DSP16op& d ) { // F1 y=Y x=*pt++[i]
+    F1parse( d.f, true );
+    int aux = Yparse_read( d.Y, !in_cache );
+    //printf("next_a1 = %lX\n", next_a1);
+    y = next_y = aux;
+    if( ((auc>>6)&1)==0 ) yl=next_yl=0;
+    x = next_x = parse_pt(d.op);
+    // delta = in_cache ? 1 : 2;
+}
+
+void DSP16emu::exec_Ya( const DSP16op& d ) { // F1 Y=aT[l]
+    int aux2 = get_acc( d.opcode==4, // selects a1 or a0
+                       (d.op&0x10)!=0 ); // selects high half
+    F1parse( d.f );
+    Yparse_write( d.Y, aux2 );
+    update_regs();
+}
+
+void DSP16emu::exec_Y( const DSP16op& d ) { // F1 Y
+    F1parse( d.f );
+    Yparse_read( d.Y, false );
+}
+
+void DSP16emu::exec_none( const DSP16op& ) {
+}
+
+const OpHandler DSP16emu::handlers[32] = {
+    &DSP16emu::exec_goto,     &DSP16emu::exec_goto,       // 0, 1
+    &DSP16emu::exec_short_imm,&DSP16emu::exec_short_imm,  // 2, 3
+    &DSP16emu::exec_Ya,       &DSP16emu::exec_none,       // 4, 5
+    &DSP16emu::exec_Y,        &DSP16emu::exec_aTY,        // 6, 7
+    &DSP16emu::exec_aTR,      &DSP16emu::exec_Ra0,        // 8, 9
+    &DSP16emu::exec_long_imm, &DSP16emu::exec_Ra1,        // 10, 11
+    &DSP16emu::exec_YR,       &DSP16emu::exec_none,       // 12, 13
+    &DSP16emu::exec_do,       &DSP16emu::exec_RY,         // 14, 15
+    &DSP16emu::exec_call,     &DSP16emu::exec_call,       // 16, 17
+    &DSP16emu::exec_none,     &DSP16emu::exec_if_F2,      // 18, 19
+    &DSP16emu::exec_Yy,       &DSP16emu::exec_Zy,         // 20, 21
+    &DSP16emu::exec_xY,       &DSP16emu::exec_yY,         // 22, 23
+    &DSP16emu::exec_gotoB,    &DSP16emu::exec_ya_xX,      // 24, 25
+    &DSP16emu::exec_ifc,      &DSP16emu::exec_ya_xX,      // 26, 27
+    &DSP16emu::exec_Ya,       &DSP16emu::exec_none,       // 28, 29
+    &DSP16emu::exec_none,     &DSP16emu::exec_yY_xX       // 30, 31
+};
+
+int DSP16emu::eval() {
+    if( engine==ENGINE_THREADED ) return eval_threaded(1);
+    if( irq|irq_latch|clr_iack ) {
+        int c = check_irq();
+        if( c ) return c;
+    }
+    bool last_loop;
+    const DSP16op& d = fetch_next( last_loop );
+
+    switch( d.opcode ) {
+        case 0: // goto JA
+        case 1:    exec_goto(d);      break;
         case 2: // short immediate
-        case 3:
-            aux = op & 0x1ff;
-            //printf("DEBUG = %X\n", (pc>>9)&7);
-            switch( (op>>9)&7 ) {
-                case 0: next_j  = aux; if(next_j&0x100) next_j |= 0xff00; break;
-                case 1: next_k  = aux; if(next_k&0x100) next_k |= 0xff00; break;
-                case 2: next_rb = aux; break;
-                case 3: next_re = aux; break;
-                case 4: next_r0 = aux; break;
-                case 5: next_r1 = aux; break;
-                case 6: next_r2 = aux; break;
-                case 7: next_r3 = aux; break;
-            }
-            delta=1;
-            break;
-        case 7: // aT[l] = Y
-            F1parse( op );
-            aux = Yparse_read( op&0xf, false );
-            assign_acc( ((~op)>>10)&1, (op>>4)&1, aux, false );
-            delta = 1;
-            update_overflow();
-            break;
-        case 0x8: // aT = R
-            aux = (op>>4)&0x3f;
-            aux2 = get_register(aux);
-            //printf("aT=R (%d)  -- op == %X\n",aux,op);
-            if( (op>>10)&1 )
-                a0 = assign_high( 1, next_a0, aux2 ); // 1 selects a0
-            else
-                a1 = assign_high( 2, next_a1, aux2 ); // 0 selects a1
-            delta = 2;
-            update_overflow();
-            break;
-        case 0x9: // R = a0
-            aux  = (op>>4)&0x3f;
-            delta = 2;
-            set_register( aux, get_acc(0, true, aux!=RFIELD_Y && aux!=RFIELD_YL ) );
-            break;
-        case 0xa: // long imm
-            aux  = (op>>4)&0x3f;
-            aux2 = read_rom(pc++);
-            next_pi = pc;
-            pi = pc;
-            delta=2;
-            //printf("R = imm    [%X] = %X\n", aux, aux2);
-            set_register( aux, aux2 );
-            break;
-        case 0xc: // 12, Y=R
-            aux  = (op>>4)&0x3f;
-            aux2 = get_register(aux);
-            aux  = op&0xf;
-            Yparse_write( aux, aux2 );
-            // printf("Y = R [%X] = %X\n",aux,aux2);
-            delta = 2;
-            break;
-        case 0xe: // 14, Do/Redo
-            in_cache = true;
-            aux = (op>>7)&0xf;
-            if( aux!=0 ) {
-                cache_start=pc;
-                cache_end=pc+aux;
-            } else {
-                pc = cache_start; // re-do
-            }
-            cache_first=true;
-            cache_left = op&0x7f;
-            if( verbose ) printf("Cache loop starts (NI=%d, loops=%d). Repeat %04X-%04X\n",
-                aux, cache_left, cache_start, cache_end );
-            update_regs();
-            delta = 1;
-            break;
-        case 0xf: // R=Y
-            aux  = (op>>4)&0x3f;
-            aux2 = op&0xf;
-            //printf("R=Y [%02X] = %X\n", aux, aux2);
-            //printf("next a0 = %lX\n", next_a0 );
-            set_register( aux, Yparse_read( aux2 ) );
-            delta = 2;
-            break;
+        case 3:    exec_short_imm(d); break;
+        case 7:    exec_aTY(d);       break;
+        case 0x8:  exec_aTR(d);       break;
+        case 0x9:  exec_Ra0(d);       break;
+        case 0xa:  exec_long_imm(d);  break;
+        case 0xb:  exec_Ra1(d);       break;
+        case 0xc:  exec_YR(d);        break;
+        case 0xe:  exec_do(d);        break;
+        case 0xf:  exec_RY(d);        break;
+        case 0x10: // call JA
+        case 0x11: exec_call(d);      break;
+        case 0x18: exec_gotoB(d);     break;
+        case 0x1a: exec_ifc(d);       break;
         // F2
-        case 0x13: // 19
-            if( CONparse(op) ) {
-                F2parse( op );
-                //printf("next flags=%X\n", next_psw>>24);
-            }
-            delta = 1;
-            break;
+        case 0x13: exec_if_F2(d);     break;
         // F1 operations:
-        case 0x14: // 20 Y=y[l] F1
-            aux2 = (op&0x10) ? y : yl;
-            aux2 &= 0xffff;
-            F1parse( op );
-            Yparse_write( op&0xf, aux2 );
-            update_regs();
-            delta = 2;
-            break;
-        case 21: // Z:y F1
-            F1parse( op, true );
-            parseZ(op);
-            delta = 2;
-            break;
-        case 22: // x=Y F1
-            F1parse( op );
-            aux = Yparse_read( op&0xf, false );
-            next_x = aux;
-            delta = 1;
-            break;
-        case 23: // y=Y F1
-            F1parse( op );
-            aux = Yparse_read( op&0xf, false );
-            if( op&0x10 ) {
-                next_y = aux;
-                if( ((auc>>6)&1)==0 ) next_yl=0;
-            }
-            else
-                next_yl = aux;
-            delta = 1;
-            break;
+        case 0x14: exec_Yy(d);        break;
+        case 21:   exec_Zy(d);        break;
+        case 22:   exec_xY(d);        break;
+        case 23:   exec_yY(d);        break;
         case 25: // 0x19
-        case 27:
-            //if(verbose ) printf("OP 27. as = {%X, %X}\n", aux, aux2);
-            next_y  = get_acc( opcode==27 ? 1 : 0, true, false );
-            F1parse( op, true );
-            y = next_y;
-            if( (auc&0x40)==0 )
-                next_yl = yl = 0;
-            x = next_x = parse_pt(op);
-            // delta = in_cache ? 1 : 2;
-            delta = 2;
-            break;
+        case 27:   exec_ya_xX(d);     break;
         // case 28:
-        case 31: // F1 y=Y x=*pt++[i]
-            F1parse( op, true );
-            aux = Yparse_read( op&0xf, !in_cache );
-            //printf("next_a1 = %lX\n", next_a1);
-            y = next_y = aux;
-            if( ((auc>>6)&1)==0 ) yl=next_yl=0;
-            x = next_x = parse_pt(op);
-            // delta = in_cache ? 1 : 2;
-            delta = 2;
-            break;
+        case 31:   exec_yY_xX(d);     break;
         case 4: // F1 Y=a1
-        case 28: // 0x1C
-            aux2 = get_acc( opcode==4, // selects a1 or a0
-                           (op&0x10)!=0 ); // selects high half
-            F1parse( op );
-            Yparse_write( op&0xf, aux2 );
-            update_regs();
-            delta = 2;
-            break;
-        case 6: // F1 Y
-            F1parse( op );
-            Yparse_read( op&0xf, false );
-            delta = 1;
-            break;
+        case 28:   exec_Ya(d);        break; // 0x1C
+        case 6:    exec_Y(d);         break;
         // default:
     }
-    if( last_loop ) {
-        if( verbose ) printf("Extra tick added for last loop\n");
-        delta++;
+    return retire( d, last_loop );
+}
+
+// F1 with the function and the accumulators fixed at translation. PS is
+// the p alignment of the AUC mode: none, >>2 or <<2. The product is left
+// out when the block overwrites it before it is read
+template<int F, int S, int D, int PS> void DSP16emu::F1_spec( bool up_now ) {
+    int ov0 = (psw&0x010)!=0;
+    int ov1 = (psw&0x200)!=0;
+    int64_t& ad = D ? a1 : a0;
+    int64_t& next_ad = D ? next_a1 : next_a0;
+    int64_t as = S ? a1 : a0;
+    if ( as >> 35 )
+        as |= 0x10'0000'0000; // sign extend to 36 bits
+    int pre = PS==1 ? p>>2 : PS==2 ? p<<2 : p;
+    int64_t pext = (int64_t)pre & 0x1F'FFFF'FFFF;
+    int64_t r = ad;
+    switch( F ) {
+        case  0: r = pext;              break;
+        case  1: r = as + pext;         break;
+        case  3: r = as - pext;         break;
+        case  4: r = pext;              break;
+        case  5: r = as + pext;         break;
+        case  7: r = as - pext;         break;
+        case  8: r = as | extend_y();   break;
+        case  9: r = as ^ extend_y();   break;
+        case 10: r = as & extend_y();   break;
+        case 11: r = as - extend_y();   break;
+        case 12: r = extend_y();        break;
+        case 13: r = as + extend_y();   break;
+        case 14: r = as & extend_y();   break;
+        case 15: r = as - extend_y();   break;
+    }
+    if( F<4 && mul_live ) product();
+    const bool no_r = F==2 || F==6 || F==10 || F==11;
+    if( !no_r ) {
+        int sign_bits = (r>>31)&0x1F;
+        (D ? ov1 : ov0) = sign_bits!=0 && sign_bits!=0x1F;
+        next_ad = r & 0x0F'FFFF'FFFFL;
+        if( up_now ) ad = next_ad;
+    }
+    if( up_now ) p = next_p;
+    if( F!=2 && F!=6 && flags_live ) set_psw( r, ov0, ov1, up_now );
+}
+
+// Y field with the pointer register and its step fixed at translation.
+// STEP 3 is j. The virtual shift register only applies to a step of one
+template<int R, int STEP> int DSP16emu::Y_spec( bool up_now ) {
+    int& rp = R==0 ? r0 : R==1 ? r1 : R==2 ? r2 : r3;
+    int& rn = R==0 ? next_r0 : R==1 ? next_r1 : R==2 ? next_r2 : next_r3;
+    int delta = STEP==3 ? j : STEP==2 ? -1 : STEP;
+    if( (STEP==1 || STEP==3) && re!=0 && re==rp && delta==1 )
+        rn = rb;
+    else
+        rn = (rp+delta)&0xffff;
+    int a = rp;
+    if( up_now ) rp = rn;
+    return a;
+}
+
+#define DSP16_F1(PS,f)      &DSP16emu::F1_spec<(f)&15,((f)>>4)&1,((f)>>5)&1,PS>
+#define DSP16_F1x4(PS,f)    DSP16_F1(PS,f), DSP16_F1(PS,f+1), DSP16_F1(PS,f+2), DSP16_F1(PS,f+3)
+#define DSP16_F1x16(PS,f)   DSP16_F1x4(PS,f), DSP16_F1x4(PS,f+4), DSP16_F1x4(PS,f+8), DSP16_F1x4(PS,f+12)
+#define DSP16_F1x64(PS)     DSP16_F1x16(PS,0), DSP16_F1x16(PS,16), DSP16_F1x16(PS,32), DSP16_F1x16(PS,48)
+
+const F1Handler DSP16emu::f1_spec[3][64] = {
+    { DSP16_F1x64(0) }, { DSP16_F1x64(1) }, { DSP16_F1x64(2) }
+};
+
+#undef DSP16_F1
+#undef DSP16_F1x4
+#undef DSP16_F1x16
+#undef DSP16_F1x64
+
+#define DSP16_Y(R) &DSP16emu::Y_spec<R,0>, &DSP16emu::Y_spec<R,1>, &DSP16emu::Y_spec<R,2>, &DSP16emu::Y_spec<R,3>
+
+const YHandler DSP16emu::y_spec[16] = { DSP16_Y(0), DSP16_Y(1), DSP16_Y(2), DSP16_Y(3) };
+
+#undef DSP16_Y
+
+// Translated versions of the exec_ handlers. Blocks never run inside a
+// cache loop, so the F1 operations that update at once when outside the
+// cache always do so here
+void DSP16emu::uop_generic( const DSP16uop& u ) {
+    (this->*u.d->handler)( *u.d );
+}
+
+void DSP16emu::uop_short( const DSP16uop& u ) {
+    this->*u.sreg = u.imm;
+}
+
+void DSP16emu::uop_Y( const DSP16uop& u ) { // F1 Y
+    (this->*u.f1)( false );
+    ram_read( (this->*u.yaddr)( false ) );
+}
+
+void DSP16emu::uop_aTY( const DSP16uop& u ) { // aT[l] = Y
+    (this->*u.f1)( false );
+    int aux = ram_read( (this->*u.yaddr)( false ) );
+    assign_acc( ((~u.d->op)>>10)&1, (u.d->op>>4)&1, aux, false );
+}
+
+void DSP16emu::uop_xY( const DSP16uop& u ) { // x=Y F1
+    (this->*u.f1)( false );
+    next_x = ram_read( (this->*u.yaddr)( false ) );
+}
+
+void DSP16emu::uop_yY( const DSP16uop& u ) { // y=Y F1
+    (this->*u.f1)( false );
+    int aux = ram_read( (this->*u.yaddr)( false ) );
+    if( u.d->op&0x10 ) {
+        next_y = aux;
+        if( u.ycl ) next_yl=0;
+    }
+    else
+        next_yl = aux;
+}
+
+void DSP16emu::uop_Ya( const DSP16uop& u ) { // F1 Y=aT[l]
+    int aux2 = get_acc( u.d->opcode==4, (u.d->op&0x10)!=0 );
+    (this->*u.f1)( false );
+    ram_write( (this->*u.yaddr)( true ), aux2 );
+    update_regs();
+}
+
+void DSP16emu::uop_Yy( const DSP16uop& u ) { // Y=y[l] F1
+    int aux2 = ((u.d->op&0x10) ? y : yl) & 0xffff;
+    (this->*u.f1)( false );
+    ram_write( (this->*u.yaddr)( true ), aux2 );
+    update_regs();
+}
+
+void DSP16emu::uop_Zy( const DSP16uop& u ) { // Z:y F1
+    (this->*u.f1)( true );
+    parseZ( u.d->op );
+}
+
+void DSP16emu::uop_ya_xX( const DSP16uop& u ) { // F1 y=aT x=*pt++[i]
+    next_y = get_acc( u.d->opcode==27 ? 1 : 0, true, false );
+    (this->*u.f1)( true );
+    y = next_y;
+    if( u.ycl ) next_yl = yl = 0;
+    x = next_x = parse_pt( u.d->op );
+}
+
+void DSP16emu::uop_yY_xX( const DSP16uop& u ) { // F1 y=Y x=*pt++[i]
+    (this->*u.f1)( true );
+    y = next_y = ram_read( (this->*u.yaddr)( true ) );
+    if( u.ycl ) yl = next_yl = 0;
+    x = next_x = parse_pt( u.d->op );
+}
+
+// Instructions that may change the PC end the block, and so do the writes
+// to AUC, SIOC and PIOC. The next block is then looked up for the new mode.
+// Only the AUC mode is folded into the translation. The block also ends at
+// the last ROM address, as pc>0xfff is not decoded
+DSP16block *DSP16emu::translate( int a, int mode ) {
+    DSP16block *b = new DSP16block();   // all fields start cleared
+    b->auc  = mode;
+    int  ps  = (mode&3)==3 ? 0 : mode&3;
+    bool ycl = (mode&0x40)==0;
+    bool end = false;
+    while( !end && b->len<BLOCK_MAX && a<=0xfff ) {
+        const DSP16op& d = code->dec[a++];
+        switch( d.opcode ) {
+            case 0: case 1:     // goto JA
+            case 10:            // long immediate
+            case 14:            // do/redo
+            case 16: case 17:   // call JA
+            case 24:            // goto B
+            case 26:            // if CON, the branch after it is in the next block
+                end = true;
+                break;
+            case 9: case 11: case 15:
+                end = d.r==19 || d.r==24 || d.r==28;
+                break;
+            default:
+                end = d.cycles==0; // unsupported
+        }
+        DSP16uop& u = b->ops[ b->len++ ];
+        u.d     = &d;
+        u.f1    = f1_spec[ps][d.f];
+        u.yaddr = y_spec[d.Y];
+        u.ycl   = ycl;
+        switch( d.opcode ) {
+            case 2: case 3: {
+                static int DSP16emu::* const sregs[8] = {
+                    &DSP16emu::next_j,  &DSP16emu::next_k,  &DSP16emu::next_rb, &DSP16emu::next_re,
+                    &DSP16emu::next_r0, &DSP16emu::next_r1, &DSP16emu::next_r2, &DSP16emu::next_r3 };
+                int sel = (d.op>>9)&7;
+                u.run  = &DSP16emu::uop_short;
+                u.sreg = sregs[sel];
+                u.imm  = d.op & 0x1ff;
+                if( sel<2 && (u.imm&0x100) ) u.imm |= 0xff00;
+                break;
+            }
+            case 4: case 28: u.run = &DSP16emu::uop_Ya;    break;
+            case 6:          u.run = &DSP16emu::uop_Y;     break;
+            case 7:          u.run = &DSP16emu::uop_aTY;   break;
+            case 20:         u.run = &DSP16emu::uop_Yy;    break;
+            case 21:         u.run = &DSP16emu::uop_Zy;    break;
+            case 22:         u.run = &DSP16emu::uop_xY;    break;
+            case 23:         u.run = &DSP16emu::uop_yY;    break;
+            case 25: case 27:u.run = &DSP16emu::uop_ya_xX; break;
+            case 31:         u.run = &DSP16emu::uop_yY_xX; break;
+            default:         u.run = &DSP16emu::uop_generic;
+        }
+    }
+    // The flags only need to be computed if they may be read before
+    // another F1 operation sets them again, and the product if it may be
+    // read before another one replaces it. As the PSW and p registers get
+    // them one instruction later, they are live across the last two for
+    // the same reason. If the block ends early, the flags and the product
+    // of an instruction show up to the one that overwrites them, so
+    // eval_block keeps them if the block may end in that window
+    auto is_f1 = []( int t ) {
+        return t==4 || t==6 || t==7 || (t>=20 && t<=23) || t==25 || t==27 || t==28 || t==31;
+    };
+    bool flive = true, mlive = true;
+    int  fcycles = 0, mcycles = 0, fstops = 0, mstops = 0;
+    for( int k=b->len-1; k>=0; k-- ) {
+        DSP16uop& u = b->ops[k];
+        const DSP16op& d = *u.d;
+        int t = d.opcode, f = d.f&0xf;
+        bool rd = t==8 || t==12, wr = t==9 || t==10 || t==11 || t==15;
+        int stops = 0;
+        if( (rd || wr) && (d.r==29 || d.r==30) ) stops = rd ? EVENT_PIDS : EVENT_PODS;
+        if( t==25 || t==27 || t==31 ) stops = EVENT_EXTROM;
+        fcycles += d.cycles;
+        mcycles += d.cycles;
+        fstops  |= stops;
+        mstops  |= stops;
+        u.flags   = flive;
+        u.fwindow = fcycles;
+        u.fstops  = fstops;
+        u.mul     = mlive;
+        u.mwindow = mcycles;
+        u.mstops  = mstops;
+        if( k==b->len-1 ) continue;
+        if( is_f1(t) && f!=2 && f!=6 ) { // F1 sets the flags
+            flive   = false;
+            fcycles = d.cycles;
+            fstops  = stops;
+        }
+        if( t==19 || t==26 || (rd && d.r==RFIELD_PSW) ) flive = true; // CON or PSW read
+        if( (is_f1(t) && (f==0 || f==1 || f==3 || f==4 || f==5 || f==7)) || (t==19 && f==8) ) {
+            mlive = true;   // p is read
+        } else if( is_f1(t) && f<4 ) { // p is replaced
+            mlive   = false;
+            mcycles = d.cycles;
+            mstops  = stops;
+        }
+    }
+    return b;
+}
+
+// Runs a translated block. The cache loop control is only handled
+// by eval(), so instructions inside a do loop run one at a time. The
+// block ends early if an interrupt may be pending, so it is taken at the
+// same instruction as in eval(), if a run_until event occurs or if the
+// budget is used up
+int DSP16emu::eval_block( int budget ) {
+    if( in_cache || verbose || pc>0xfff || (irq|irq_latch|clr_iack) ) return eval();
+    // the AUC of the block is set when its first instruction is fetched
+    int mode = next_auc & 0x7f;
+    DSP16block *b = blocks[pc], *prev = nullptr;
+    int chained = 0;
+    while( b!=nullptr && b->auc!=mode ) {
+        if( ++chained==BLOCK_MODES ) { // drop the least recently added mode
+            prev->next = nullptr;
+            delete b;
+            b = nullptr;
+            break;
+        }
+        prev = b;
+        b = b->next;
+    }
+    if( b==nullptr ) {
+        b = translate( pc, mode );
+        b->next = blocks[pc];
+        blocks[pc] = b;
+    }
+    int total = 0;
+    for( int k=0; k<b->len; k++ ) {
+        const DSP16uop& u = b->ops[k];
+        pc++;
         update_regs();
+        if( shadow ) next_pi = pc;
+        if( cov ) cov->hit( u.d->op, auc );
+        // the results are needed if the block may end before they are overwritten
+        flags_live = u.flags || may_end( u.fwindow, u.fstops, total, budget );
+        mul_live   = u.mul   || may_end( u.mwindow, u.mstops, total, budget );
+        (this->*u.run)( u );
+        total += u.d->cycles;
+        add_ticks( u.d->cycles ); // strobes and SIO words may fall inside the block
+        if( (irq|irq_latch|clr_iack) || total>=budget || stopped() ) break;
     }
-    ticks += delta;
-    return delta;
+    flags_live = mul_live = true;
+    return total;
+}
+
+int DSP16emu::eval( int n ) {
+    if( engine==ENGINE_THREADED ) return eval_threaded(n);
+    int total = 0;
+    while( n-- > 0 ) total += eval();
+    return total;
+}
+
+EmuRun DSP16emu::run_until( int budget, int event_mask ) {
+    EmuRun run;
+    events = 0;
+    run.cycles = eval();
+    stop_mask = event_mask;
+    stop_pc = (event_mask & EVENT_BREAK) ? breakpoint : -1;
+    run.cycles = run_rest( run.cycles, budget );
+    run.events = events & event_mask;
+    stop_mask = 0;
+    stop_pc = -1;
+    return run;
+}
+
+// Goes on with a run_until that has already used some cycles
+int DSP16emu::run_rest( int cycles, int budget ) {
+    if( engine==ENGINE_THREADED )
+        cycles += eval_threaded( 0x7fff'ffff, budget-cycles );
+    else if( engine==ENGINE_BLOCK ) {
+        while( cycles<budget && !stopped() )
+            cycles += eval_block( budget-cycles );
+    } else {
+        while( cycles<budget && !stopped() )
+            cycles += eval();
+    }
+    return cycles;
+}
+
+// Runs up to n instructions. The next instruction is dispatched directly
+// from the end of the current one, so each handler has its own indirect
+// jump instead of sharing the one of the switch in eval()
+int DSP16emu::eval_threaded( int n, int budget ) {
+    int total = 0;
+    bool last_loop;
+    const DSP16op* d;
+#if defined(__GNUC__) || defined(__clang__)
+    static void* const labels[32] = {
+        &&L_goto,  &&L_goto,  &&L_short, &&L_short, &&L_Ya,   &&L_none, &&L_Y,    &&L_aTY,
+        &&L_aTR,   &&L_Ra0,   &&L_long,  &&L_Ra1,   &&L_YR,   &&L_none, &&L_do,   &&L_RY,
+        &&L_call,  &&L_call,  &&L_none,  &&L_if_F2, &&L_Yy,   &&L_Zy,   &&L_xY,   &&L_yY,
+        &&L_gotoB, &&L_ya_xX, &&L_ifc,   &&L_ya_xX, &&L_Ya,   &&L_none, &&L_none, &&L_yY_xX
+    };
+    // interrupts are only checked when one may be pending
+    #define DSP16_DISPATCH if( n-- <= 0 || total>=budget || stopped() ) return total; \
+        if( irq|irq_latch|clr_iack ) goto L_irq; \
+        d = &fetch_next( last_loop ); goto *labels[d->opcode];
+    #define DSP16_NEXT total += retire( *d, last_loop ); DSP16_DISPATCH
+
+    DSP16_DISPATCH
+    L_irq:
+        if( int c=check_irq() ) {
+            total += c;
+            DSP16_DISPATCH
+        }
+        d = &fetch_next( last_loop ); goto *labels[d->opcode];
+    L_goto:   exec_goto(*d);      DSP16_NEXT
+    L_call:   exec_call(*d);      DSP16_NEXT
+    L_gotoB:  exec_gotoB(*d);     DSP16_NEXT
+    L_ifc:    exec_ifc(*d);       DSP16_NEXT
+    L_short:  exec_short_imm(*d); DSP16_NEXT
+    L_Ya:     exec_Ya(*d);        DSP16_NEXT
+    L_Y:      exec_Y(*d);         DSP16_NEXT
+    L_aTY:    exec_aTY(*d);       DSP16_NEXT
+    L_aTR:    exec_aTR(*d);       DSP16_NEXT
+    L_Ra0:    exec_Ra0(*d);       DSP16_NEXT
+    L_Ra1:    exec_Ra1(*d);       DSP16_NEXT
+    L_long:   exec_long_imm(*d);  DSP16_NEXT
+    L_YR:     exec_YR(*d);        DSP16_NEXT
+    L_do:     exec_do(*d);        DSP16_NEXT
+    L_RY:     exec_RY(*d);        DSP16_NEXT
+    L_if_F2:  exec_if_F2(*d);     DSP16_NEXT
+    L_Yy:     exec_Yy(*d);        DSP16_NEXT
+    L_Zy:     exec_Zy(*d);        DSP16_NEXT
+    L_xY:     exec_xY(*d);        DSP16_NEXT
+    L_yY:     exec_yY(*d);        DSP16_NEXT
+    L_ya_xX:  exec_ya_xX(*d);     DSP16_NEXT
+    L_yY_xX:  exec_yY_xX(*d);     DSP16_NEXT
+    L_none:                       DSP16_NEXT
+    #undef DSP16_DISPATCH
+    #undef DSP16_NEXT
+#else
+    while( n-- > 0 && total<budget && !stopped() ) {
+        if( irq|irq_latch|clr_iack ) {
+            int c = check_irq();
+            total += c;
+            if( c ) continue;
+        }
+        d = &fetch_next( last_loop );
+        (this->*d->handler)( *d );
+        total += retire( *d, last_loop );
+    }
+    return total;
+#endif
 }
 
 int16_t DSP16emu::read_rom(int a) {
@@ -992,4 +2059,6 @@ int16_t DSP16emu::read_rom(int a) {
         return 0; // no external data
     else
     return rom[a];
-}
\ No newline at end of file
+}
+
+#endif
@@ -1,21 +1,67 @@
 #include "WaveWritter.h"
+#include <cmath>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <unistd.h>
 
 using namespace std;
 
+static int stdout_fd = -1; // the original stdout, once it is claimed for the audio
+
+void WaveWritter::claim_stdout() {
+    if( stdout_fd>=0 ) return;
+    fflush( stdout );
+    stdout_fd = dup(1);
+    dup2( 2, 1 );
+}
+
 void WaveWritter::write( int16_t* lr ) {
-    fsnd.write( (char*)lr, sizeof(int16_t)*2 );
+    if( format==AUDIO_FLOAT ) {
+        float f[2] = { lr[0]/32768.0f, lr[1]/32768.0f };
+        memcpy( &buffer[fill], f, sizeof(f) );
+        fill += sizeof(f);
+    } else {
+        memcpy( &buffer[fill], lr, sizeof(int16_t)*2 );
+        fill += sizeof(int16_t)*2;
+    }
     if( dump_hex ) {
         fhex << hex << lr[0] << '\n';
         fhex << hex << lr[1] << '\n';
     }
+    pending++;
+    if( fill+2*sizeof(float) > buffer.size() || (flush_every && pending>=flush_every) )
+        flush();
+}
+
+void WaveWritter::flush() {
+    if( fill ) {
+        fwrite( buffer.data(), 1, fill, fsnd );
+        data_bytes += fill;
+        fill = 0;
+    }
+    pending = 0;
+    fflush( fsnd );
 }
 
-void WaveWritter::Constructor( const char *filename, int sample_rate, bool hex ) {
+void WaveWritter::Constructor( const char *filename, double sample_rate, bool hex,
+        AudioFormat fmt, int _flush_every ) {
     name = filename;
-    fsnd.open(filename, ios_base::binary);
-    dump_hex = hex;
+    format = fmt;
+    flush_every = _flush_every;
+    fill = 0;
+    pending = 0;
+    data_bytes = 0;
+    buffer.resize( BUFFER_SIZE );
+    streaming = name=="-";
+    if( streaming ) {
+        claim_stdout();
+        fsnd = fdopen( dup(stdout_fd), "wb" ); // fclose leaves stdout_fd open
+    } else {
+        fsnd = fopen( filename, "wb" );
+    }
+    if( fsnd==nullptr ) throw runtime_error(string("Cannot write audio to ")+filename);
+    dump_hex = hex && !streaming;
     if( dump_hex ) {
         char *hexname;
         hexname = new char[strlen(filename)+1];
@@ -25,38 +71,69 @@ void WaveWritter::Constructor( const char *filename, int sample_rate, bool hex )
         fhex.open(hexname);
         delete[] hexname;
     }
-    // write header
-    char zero=0;
-    for( int k=0; k<45; k++ ) fsnd.write( &zero, 1 );
-    fsnd.seekp(0);
-    fsnd.write( "RIFF", 4 );
-    fsnd.seekp(8);
-    fsnd.write( "WAVEfmt ", 8 );
-    int32_t number32 = 16;
-    fsnd.write( (char*)&number32, 4 );
-    int16_t number16 = 1;
-    fsnd.write( (char*) &number16, 2);
-    number16=2;
-    fsnd.write( (char*) &number16, 2);
+    // The WAV header only takes integer rates. When streaming, the
+    // lengths are not known, so they are set to the maximum
+    header_len = 0;
+    if( format!=AUDIO_RAW )
+        write_header( (int)lround(sample_rate),
+            streaming ? 0xFFFF'FFFF-(format==AUDIO_FLOAT ? 50 : 36) : 0 );
+}
+
+// Float WAV files need the 18-byte fmt chunk and a fact chunk with
+// the number of sample frames, which follows the fmt chunk
+void WaveWritter::write_header( int sample_rate, uint32_t data_len ) {
+    const bool    fp = format==AUDIO_FLOAT;
+    const int16_t bits = fp ? 32 : 16;
+    const int16_t align = 2*bits/8;
+    const uint32_t fmt_len = fp ? 18 : 16;
+    char h[58];
+    header_len = fp ? 58 : 44;
+    memcpy( h, "RIFF", 4 );
+    uint32_t number32 = data_len+header_len-8;
+    memcpy( h+4, &number32, 4 );
+    memcpy( h+8, "WAVEfmt ", 8 );
+    memcpy( h+16, &fmt_len, 4 );
+    int16_t number16 = fp ? 3 : 1; // IEEE float or PCM
+    memcpy( h+20, &number16, 2 );
+    number16 = 2;   // channels
+    memcpy( h+22, &number16, 2 );
     number32 = sample_rate;
-    fsnd.write( (char*)&number32, 4 );
-    number32 = sample_rate*2*2;
-    fsnd.write( (char*)&number32, 4 );
-    number16=2*2;   // Block align
-    fsnd.write( (char*) &number16, 2);
-    number16=16;
-    fsnd.write( (char*) &number16, 2);
-    fsnd.write( "data", 4 );
-    fsnd.seekp(44);
+    memcpy( h+24, &number32, 4 );
+    number32 = sample_rate*align;
+    memcpy( h+28, &number32, 4 );
+    memcpy( h+32, &align, 2 );  // Block align
+    memcpy( h+34, &bits, 2 );
+    char *p = h+36;
+    if( fp ) {
+        number16 = 0;   // no extra fmt data
+        memcpy( p, &number16, 2 );
+        memcpy( p+2, "fact", 4 );
+        number32 = 4;
+        memcpy( p+6, &number32, 4 );
+        number32 = data_len/align;
+        memcpy( p+10, &number32, 4 );
+        p += 14;
+    }
+    memcpy( p, "data", 4 );
+    memcpy( p+4, &data_len, 4 );
+    fwrite( h, 1, header_len, fsnd );
 }
 
 WaveWritter::~WaveWritter() {
-    int32_t number32;
-    streampos file_length = fsnd.tellp();
-    number32 = (int32_t)file_length-8;
-    fsnd.seekp(4);
-    fsnd.write( (char*)&number32, 4);
-    fsnd.seekp(40);
-    number32 = (int32_t)file_length-44;
-    fsnd.write( (char*)&number32, 4);
+    flush();
+    if( format!=AUDIO_RAW && !streaming ) {
+        uint32_t number32 = data_bytes+header_len-8;
+        fseek( fsnd, 4, SEEK_SET );
+        fwrite( &number32, 4, 1, fsnd );
+        if( format==AUDIO_FLOAT ) {
+            number32 = data_bytes/(2*sizeof(float)); // sample frames
+            fseek( fsnd, 46, SEEK_SET );
+            fwrite( &number32, 4, 1, fsnd );
+        }
+        number32 = data_bytes;
+        fseek( fsnd, header_len-4, SEEK_SET );
+        fwrite( &number32, 4, 1, fsnd );
+    }
+    fclose( fsnd );
+    fsnd = nullptr;
 }
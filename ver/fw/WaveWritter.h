@@ -1,23 +1,53 @@
 #ifndef __WAVEWRITTER_H
 #define __WAVEWRITTER_H
 
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <string>
+#include <vector>
 
+enum AudioFormat {
+    AUDIO_WAV,      // 16-bit PCM WAV file
+    AUDIO_FLOAT,    // 32-bit float WAV file
+    AUDIO_RAW       // 16-bit PCM without header
+};
+
+// Stereo audio output. Samples are kept in a block buffer, which is
+// written when it fills up, every flush_every samples if it is not zero,
+// or when flush() is called. The file name "-" streams to stdout, and
+// the program messages are moved to stderr
 class WaveWritter {
-    std::ofstream fsnd, fhex;
+    FILE *fsnd;
+    std::ofstream fhex;
     std::string name;
-    bool dump_hex;
-    void Constructor(const char *filename, int sample_rate, bool hex );
+    bool dump_hex, streaming;
+    AudioFormat format;
+    std::vector<char> buffer;
+    size_t fill;
+    int flush_every, pending;
+    int64_t data_bytes;
+    int header_len;     // the data length is in its last four bytes
+    void Constructor(const char *filename, double sample_rate, bool hex,
+        AudioFormat fmt, int _flush_every );
+    void write_header( int sample_rate, uint32_t data_len );
 public:
-    WaveWritter(const char *filename, int sample_rate, bool hex ) {
-        Constructor( filename, sample_rate, hex );
+    static const int BUFFER_SIZE=64*1024;
+    WaveWritter(const char *filename, double sample_rate, bool hex,
+        AudioFormat fmt=AUDIO_WAV, int _flush_every=0 ) {
+        Constructor( filename, sample_rate, hex, fmt, _flush_every );
     }
-    WaveWritter(const std::string &filename, int sample_rate, bool hex ) {
-        Constructor( filename.c_str(), sample_rate, hex );
+    WaveWritter(const std::string &filename, double sample_rate, bool hex,
+        AudioFormat fmt=AUDIO_WAV, int _flush_every=0 ) {
+        Constructor( filename.c_str(), sample_rate, hex, fmt, _flush_every );
     }
     void write( int16_t *lr );
+    void flush();
+    // Moves the program messages to stderr and keeps stdout for the
+    // audio. It must run before anything is printed, as the ROM and
+    // command loaders print before the audio file is opened
+    static void claim_stdout();
     ~WaveWritter();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,244 @@
+#include "args.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+ParseArgs::ParseArgs( int argc, char *argv[]) {
+    extra = step = verbose = playback = tracecmp = allcmd = false;
+    exit = false;
+    error = false;
+    vcd_file="test.vcd";
+    trace_file="wof.tr";
+    write_vcd=false;
+    seed=0;
+    max = 100'000;
+    if( argc==1 ) return;
+    for( int k=1; k<argc; k++ ) {
+        if( argv[k][0]=='-' ) {
+            if( strcmp(argv[k],"-extra")==0 )  { extra=true;  continue; }
+            if( strcmp(argv[k],"-v")==0 ) {
+                verbose=true;
+                if(verbose) step=true;
+                continue;
+            }
+            if( strcmp(argv[k],"-w")==0 ) {
+                write_vcd=true;
+                continue;
+            }
+            if( strcmp(argv[k],"-play")==0 ) {
+                qsnd_rom = "spf2t.rom";
+                playfile = "spf2t_b1.qs";
+                if( k+1 < argc )
+                    qsnd_rom = argv[++k];
+                if( k+1 < argc ) {
+                    playfile = argv[++k];
+                }
+                playback=true;
+                continue;
+            }
+            if( strcmp(argv[k],"-allcmd")==0 ) { allcmd=true; continue; }
+            if( strcmp(argv[k],"-wav")==0 ) {
+                if( ++k < argc )
+                    wav_file=argv[k];
+                else {
+                    throw runtime_error("Expecting name of audio file after -wav");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-float")==0 ) { audio_format=AUDIO_FLOAT; continue; }
+            if( strcmp(argv[k],"-raw")==0 )   { audio_format=AUDIO_RAW;   continue; }
+            if( strcmp(argv[k],"-flush")==0 ) {
+                if( ++k < argc )
+                    flush_samples=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of samples after -flush");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-emu")==0 )      { emu=true; continue; }
+            if( strcmp(argv[k],"-realtime")==0 ) { realtime=true; continue; }
+            if( strcmp(argv[k],"-sink")==0 ) {
+                ++k;
+                if( k<argc && strcmp(argv[k],"file")==0 )      rt_sink=RT_SINK_FILE;
+                else if( k<argc && strcmp(argv[k],"fifo")==0 ) rt_sink=RT_SINK_FIFO;
+                else if( k<argc && strcmp(argv[k],"null")==0 ) rt_sink=RT_SINK_NULL;
+                else {
+                    throw runtime_error("Expecting file, fifo or null after -sink");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-latency")==0 ) {
+                if( ++k < argc && atoi(argv[k])>0 )
+                    latency=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting latency in ms after -latency");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-threaded")==0 ) { threaded=true; continue; }
+            if( strcmp(argv[k],"-block")==0 ) { blocks=true; continue; }
+            if( strcmp(argv[k],"-portload")==0 ) { port_load=true; continue; }
+            if( strcmp(argv[k],"-tracecmp")==0 ) { tracecmp=true; continue; }
+            if( strcmp(argv[k],"-trace")==0 ) {
+                if( ++k < argc )
+                    trace_file=argv[k];
+                else {
+                    throw runtime_error("Expecting name of trace file after -trace");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-jobs")==0 ) {
+                if( ++k < argc )
+                    jobs=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of jobs after -jobs");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-fuzz")==0 ) {
+                if( ++k < argc && atoi(argv[k])>0 )
+                    fuzz=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of seeds after -fuzz");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-batch")==0 ) {
+                if( ++k < argc && atoi(argv[k])>0 )
+                    batch=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of lanes after -batch");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-maxfail")==0 ) {
+                if( ++k < argc && atoi(argv[k])>0 )
+                    max_fail=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of failures after -maxfail");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-cov")==0 ) { cov=true; continue; }
+            if( strcmp(argv[k],"-image")==0 ) {
+                if( ++k < argc )
+                    image_file=argv[k];
+                else {
+                    throw runtime_error("Expecting name of test image after -image");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-shrink")==0 ) {
+                if( ++k < argc )
+                    shrink_file=argv[k];
+                else {
+                    throw runtime_error("Expecting name of assembler file after -shrink");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-segment")==0 ) {
+                if( ++k < argc && atoi(argv[k])>0 )
+                    segment=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of trace lines after -segment");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-max")==0 ) {
+                if( ++k<argc ) {
+                    max = strtol(argv[k], NULL, 0);
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-history")==0 ) {
+                if( ++k < argc )
+                    history=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting number of cycles after -history");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-mintime")==0 ) {
+                if( ++k < argc )
+                    min_sim_time=atoi(argv[k]);
+                else {
+                    throw runtime_error("Expecting minimum simulation time after -mintime");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-vcd")==0 ) {
+                if( ++k < argc )
+                    vcd_file=argv[k];
+                else {
+                    throw runtime_error("Expecting name of VCD file after -vcd");
+                }
+                continue;
+            }
+            if( strcmp(argv[k],"-h")==0 ) {
+                cout <<
+"-play [CPS rom file] [playfile] \n"
+"                      enables playback. The rom file is an MRA output.\n"
+"                      The play file should follow spf2t_b1.qs example\n"
+"                      or be a binary file made with qs2bin\n"
+"-allcmd               parses all command inputs in the file\n"
+"-wav                  audio output file (out.wav), - streams to stdout\n"
+"-float                writes 32-bit float samples\n"
+"-raw                  writes 16-bit samples without WAV header\n"
+"-flush N              writes the audio out every N samples\n"
+"-emu                  uses the emulator instead of the RTL for -play\n"
+"                      and -tracecmp. With -tracecmp it compares against\n"
+"                      a binary trace in parallel, using state checkpoints\n"
+"                      saved next to it. The first run makes them while\n"
+"                      comparing on one thread\n"
+"-realtime             plays back with the emulator at the QSound sample rate\n"
+"-sink file|fifo|null  real-time output: the -wav file, a FIFO at the\n"
+"                      -wav path or nothing (file)\n"
+"-latency N            real-time buffer in ms (50)\n"
+"-tracecmp             enables comparative traces\n"
+"-trace                name of the MAME trace file (wof.tr)\n"
+"-jobs N               threads for -tracecmp -emu, for the -fuzz seeds\n"
+"                      and for the -shrink candidates (all cores if not set)\n"
+"-segment              trace lines between checkpoints (1000000)\n"
+"seed                  number of the random test, or the first one with\n"
+"                      -fuzz (0). A seed makes the same test in a single\n"
+"                      run and in -fuzz, whatever the thread\n"
+"-fuzz N               runs N random tests from the seed\n"
+"-maxfail K            stops -fuzz after K failures (10)\n"
+"-cov                  biases the -fuzz ROMs towards instructions not\n"
+"                      covered yet. Failing tests are saved to fuzz-<seed>.bin\n"
+"-image                runs the random test in a fuzz-<seed>.bin file\n"
+"-batch N              runs the test on N lanes of the lockstep batch\n"
+"                      emulator and checks them against DSP16emu\n"
+"-shrink file.asm      shrinks the failing random test of the seed or\n"
+"                      -image and writes it for dsp16as\n"
+"-threaded             uses the threaded dispatch engine in the emulator\n"
+"-block                runs the emulator one basic block at a time, in\n"
+"                      random tests and emulator playback\n"
+"-portload             loads the RTL ROM and RAM through the programming\n"
+"                      ports even if the model has the backdoor\n"
+"-history N            keeps the last N cycles in memory and writes\n"
+"                      them to history.vcd if a problem is found\n"
+"-mintime              minimum time simulated\n"
+"-max                  maximum clock tits simulated for random tests\n"
+"-v                    verbose\n"
+"-vcd                  name of output VCD file\n";
+                exit=true;
+                break;
+            }
+            error = true;
+            cout << "Error: cannot recognize argument " << argv[k] << '\n';
+            return;
+        } else {
+            // parse as seed
+            seed = strtol(argv[k], NULL, 0);
+        }
+    }
+    // the audio stream must not get any of the messages printed from here on
+    if( wav_file=="-" ) WaveWritter::claim_stdout();
+    srand(seed);
+    if(!playback && !tracecmp && !fuzz) printf("Random seed = %d\n", seed);
+}
@@ -0,0 +1,28 @@
+#ifndef __DSP16_ARGS
+#define __DSP16_ARGS
+
+#include "WaveWritter.h"
+#include <string>
+
+// Outputs for real-time playback
+enum RTsinkType { RT_SINK_FILE, RT_SINK_FIFO, RT_SINK_NULL };
+
+// Command line options. They do not depend on the RTL, so the
+// emulator-only player shares them
+class ParseArgs {
+public:
+    bool step, extra, verbose, playback, tracecmp, allcmd, error, exit,
+         write_vcd=false, threaded=false, blocks=false, realtime=false,
+         emu=false, cov=false, port_load=false;
+    int max, seed, jobs=0, segment=1'000'000;
+    int fuzz=0, max_fail=10, batch=0;
+    int flush_samples=0, latency=50;
+    AudioFormat audio_format=AUDIO_WAV;
+    RTsinkType rt_sink=RT_SINK_FILE;
+    int min_sim_time=0, history=0;
+    std::string vcd_file, trace_file, qsnd_rom="punisher.rom", playfile,
+        wav_file="out.wav", image_file, shrink_file;
+    ParseArgs( int argc, char *argv[]);
+};
+
+#endif
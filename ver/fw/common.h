@@ -1,24 +1,45 @@
 #ifndef __DSP16_COMMON
 #define __DSP16_COMMON
 #include "Vjtdsp16.h"
+#if VM_TRACE
 #include "verilated_vcd_c.h"
+#endif
 #include "vcd.h"
+#include "qscmd.h"
+#include "WaveWritter.h"
+#include "args.h"
 #include <string>
 #include <fstream>
+#include <vector>
 
 class RTL {
     vluint64_t ticks, sim_time, half_period;
+#if VM_TRACE
     VerilatedVcdC vcd;
+#endif
     void dump(const char *, int d );
     void dump(const char *, int64_t d );
+    // ring buffer with the debug ports of the last cycles
+    std::vector<int64_t>    hist;
+    std::vector<vluint64_t> hist_time;
+    int hist_len, hist_pos, hist_cnt;
+    std::string hist_file;
+    bool fault_seen;
+    void capture();
 public:
     Vjtdsp16 top;
-    bool vcd_dump;
-    RTL(const char *vcd_name);
+    bool vcd_dump; // ignored when the model is built without --trace
+    // Memories are written straight into the model arrays instead of
+    // through the programming ports. Only available if the model was
+    // built with JTDSP16_BACKDOOR, which needs JTDSP16_DEBUG in the RTL
+    bool backdoor;
+    RTL(const char *vcd_name); // no VCD file if vcd_name is null
     void reset();
     void clk( int n=1 );
     void read_rom( int16_t* data );
     void program_ram( int16_t* data );
+    // Loads a new test in the same model, so no model or VCD file is made
+    void reinit( int16_t* rom, int16_t* ram );
     bool fault();
     // access to registers
     int  pc() { return top.debug_pc; }
@@ -80,32 +101,43 @@ public:
 
     void dump_ram();
     void screen_dump();
+    // Keeps the debug ports of the last cycles in memory. flush_history
+    // writes them to a VCD file, which is done when a problem is found
+    void keep_history( int cycles, const char *fname="history.vcd" );
+    void flush_history();
 };
 
+struct DSP16cov;
+
 class ROM {
     int16_t *rom;
+    int random_op( int valid, int incache, bool cache_ready );
 public:
-    ROM();
+    ROM( bool load=true ); // reads dl-1425.bin unless load is false
     ~ROM();
-    int random( int valid );
+    // fills the ROM with instructions of the formats in valid. The ones
+    // that reach cells not covered in guide are preferred
+    int random( int valid, const DSP16cov* guide=nullptr );
     int16_t *data() { return rom; }
 };
 
-class ParseArgs {
-public:
-    bool step, extra, verbose, playback, tracecmp, allcmd, error, exit,
-         write_vcd=false;
-    int max, seed;
-    int min_sim_time=0;
-    std::string vcd_file, trace_file, qsnd_rom="punisher.rom", playfile;
-    ParseArgs( int argc, char *argv[]);
+// Random tests, in test.cc. The emulator and the RTL run side by side
+// from the same ROM and RAM
+struct DualRun {
+    int  ops;           // instructions run
+    bool fault, diverged;
+    bool failed() const { return fault || diverged; }
 };
 
-class QSCmd {
-    VCDsignal::pointlist points;
-public:
-    QSCmd( const std::string& fname );
-    const VCDsignal::pointlist cmdlist() const { return points; }
-};
+// Output of dual_run: nothing, the result line or the VCD and dumps too
+enum DualReport { REPORT_NONE, REPORT_RESULT, REPORT_FULL };
+
+int  make_test( const ParseArgs& args, int seed, int16_t* rom, int16_t* ram,
+    const DSP16cov* guide=nullptr );
+DualRun dual_run( const ParseArgs& args, int16_t* rom, const int16_t* ram, int max_ops,
+    DualReport report, int seed, DSP16cov* cov=nullptr );
+// Test images hold the ROM and the initial RAM
+void save_image( const std::string& fname, const int16_t* rom, const int16_t* ram );
+void load_image( const std::string& fname, int16_t* rom, int16_t* ram );
 
 #endif
\ No newline at end of file
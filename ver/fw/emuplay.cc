@@ -0,0 +1,36 @@
+// QSound player built on the emulator alone, without Verilator
+// Build with: g++ -O2 -std=c++17 -pthread emuplay.cc args.cc qscmd.cc vcd.cc WaveWritter.cc -o emuplay
+//
+// emuplay -play [CPS rom file] [playfile] [-realtime] [-wav file] ...
+// It takes the same arguments as the RTL simulation. dl-1425.bin must be
+// in the current folder. The state after the firmware initialization is
+// saved there to qsnd-init.snap, so later runs skip it
+
+#include "args.h"
+#include "emuplay.h"
+#include "realtime.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+int main( int argc, char *argv[] ) {
+    try {
+        ParseArgs args( argc, argv );
+        if( args.error ) return 1;
+        if( args.exit ) return 0;
+        if( !args.playback ) {
+            printf("Use -play to select the ROM and the command file\n");
+            return 1;
+        }
+        int16_t rom[4*1024];
+        ifstream fin("dl-1425.bin",ios_base::binary);
+        if( !fin.good() ) throw runtime_error("Cannot find dl-1425.bin");
+        fin.read( (char*)rom, sizeof(rom) );
+        return args.realtime ? play_realtime( args, rom ) : play_emu( args, rom );
+    } catch( const runtime_error& e ) {
+        fprintf(stderr,"ERROR: %s\n",e.what());
+        return 1;
+    }
+}
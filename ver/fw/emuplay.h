@@ -0,0 +1,203 @@
+#ifndef __EMUPLAY_H
+#define __EMUPLAY_H
+
+#include "args.h"
+#include "qscmd.h"
+#include "qsnd.h"
+#include "WaveWritter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// QSound playback with the emulator alone. The commands and the audio
+// output follow play_timeval, but the PIO, SIO and external ROM are
+// handled here instead of through the RTL ports, so no Verilator model
+// is needed
+
+// Engine set by -threaded and -block
+DSP16engine emu_engine( const ParseArgs& args ) {
+    return args.blocks ? ENGINE_BLOCK : args.threaded ? ENGINE_THREADED : ENGINE_SWITCH;
+}
+
+// Samples before the first command, as the RTL playback waits for the
+// firmware initialization
+const int64_t QSND_INIT_FRAMES = 100;
+
+// The initialization does not depend on the commands, so the state after
+// it is kept in this file, together with its audio, the program ROM and
+// the sample ROM words it read. Later runs start from there if they use
+// the same program and have the same values at those sample addresses
+const char QSND_INIT_FILE[]  = "qsnd-init.snap";
+const char QSND_INIT_MAGIC[] = "QSNDINIT";
+const uint32_t QSND_INIT_VERSION = 1;
+
+class QSndPlayer {
+    int16_t* rom;
+    QSndData& samples;
+    DSP16emu emu;
+    QSndIO io;
+    const VCDsignal::pointlist& cmdlist;
+    VCDsignal::pointlist::const_iterator n;
+    // Time is kept in output samples, so the commands stay in step with
+    // the audio even if the emulator cycle count is not exact
+    int64_t frames, next_cmd;
+    int last_psel;
+    int16_t lr[2];
+    bool verbose, restored;
+    std::vector<int16_t> init_audio; // frames before QSND_INIT_FRAMES
+    std::vector<std::pair<int,int>> init_reads; // sample ROM reads before them
+    void schedule();
+    bool load_init();
+    void save_init();
+public:
+    QSndPlayer( int16_t* _rom, QSndData& _samples, const VCDsignal::pointlist& _cmdlist,
+        DSP16engine engine, bool _verbose=true );
+    // Runs up to the next stereo sample. Like in play_timeval, the sample
+    // is out when psel goes up, i.e. when the right channel is selected
+    void next_frame( int16_t* out );
+    bool cmd_done() const { return n==cmdlist.cend(); }
+    int64_t ms() const { return (int64_t)(frames*1000/QSOUND_RATE); }
+};
+
+QSndPlayer::QSndPlayer( int16_t* _rom, QSndData& _samples, const VCDsignal::pointlist& _cmdlist,
+        DSP16engine engine, bool _verbose ) :
+        rom(_rom), samples(_samples), emu( _rom, engine ), io( _samples, emu ), cmdlist(_cmdlist),
+        frames(0), last_psel(0), verbose(_verbose) {
+    emu.io = &io;
+    lr[0] = lr[1] = 0;
+    n = cmdlist.cbegin();
+    schedule();
+    restored = load_init();
+    if( !restored ) io.rom_log = &init_reads;
+}
+
+// Unreadable files or files for another ROM are ignored
+bool QSndPlayer::load_init() {
+    std::ifstream fin( QSND_INIT_FILE, std::ios_base::binary );
+    if( !fin.good() ) return false;
+    try {
+        SnapReader r( fin, QSND_INIT_MAGIC, QSND_INIT_VERSION );
+        std::vector<int16_t> saved_rom( 4*1024 );
+        r.get_array( saved_rom.data(), 4*1024*sizeof(int16_t) );
+        if( memcmp( saved_rom.data(), rom, 4*1024*sizeof(int16_t) )!=0 ) return false;
+        uint32_t nreads;
+        r.get( nreads );
+        for( uint32_t k=0; k<nreads; k++ ) {
+            int32_t a, v;
+            r.get( a );
+            r.get( v );
+            if( samples.get( a )!=v ) return false;
+        }
+        init_audio.resize( 2*QSND_INIT_FRAMES );
+        r.get_array( init_audio.data(), init_audio.size()*sizeof(int16_t) );
+        r.get( last_psel );
+        r.get( lr );
+        emu.load( fin );
+        io.load( r );   // last, so a failure leaves it untouched
+    } catch( const std::exception& e ) {
+        printf("Ignoring %s: %s\n", QSND_INIT_FILE, e.what() );
+        emu.reset( rom );
+        init_audio.clear();
+        last_psel = 0;
+        lr[0] = lr[1] = 0;
+        return false;
+    }
+    if( verbose ) printf("Firmware initialization read from %s\n", QSND_INIT_FILE );
+    return true;
+}
+
+void QSndPlayer::save_init() {
+    std::ofstream fout( QSND_INIT_FILE, std::ios_base::binary );
+    SnapWriter w( fout, QSND_INIT_MAGIC, QSND_INIT_VERSION );
+    w.put_array( rom, 4*1024*sizeof(int16_t) );
+    w.put( (uint32_t)init_reads.size() );
+    for( auto& k : init_reads ) {
+        w.put( (int32_t)k.first );
+        w.put( (int32_t)k.second );
+    }
+    w.put_array( init_audio.data(), init_audio.size()*sizeof(int16_t) );
+    w.put( last_psel );
+    w.put( lr );
+    emu.save( fout );
+    io.save( w );
+    if( !w.good() ) printf("Cannot write %s\n", QSND_INIT_FILE );
+}
+
+// Command times are in ns from the first one
+void QSndPlayer::schedule() {
+    if( cmd_done() ) return;
+    next_cmd = QSND_INIT_FRAMES +
+        (int64_t)((n->time-cmdlist.front().time)*QSOUND_RATE/1e9);
+}
+
+void QSndPlayer::next_frame( int16_t* out ) {
+    if( restored && frames<QSND_INIT_FRAMES ) {
+        out[0] = init_audio[2*frames];
+        out[1] = init_audio[2*frames+1];
+        frames++;
+        return;
+    }
+    while( true ) {
+        int budget = SAMPLE_CYCLES;
+        if( !cmd_done() ) {
+            if( frames>=next_cmd ) {
+                if( !io.busy() ) {
+                    if( verbose )
+                        printf("%d ms -> %02X_%04X\n", (int)ms(), (int)(n->val>>16)&0xff, (int)n->val&0xffff );
+                    io.send( n->val );
+                    n++;
+                    schedule();
+                } else {
+                    budget = 16; // check again soon
+                }
+            }
+        }
+        EmuRun r = emu.run_until( budget, EVENT_SIO | EVENT_PODS | EVENT_PIDS );
+        if( r.events & EVENT_SIO ) lr[ emu.psel ] = emu.sio_word();
+        bool rise = emu.psel && !last_psel;
+        last_psel = emu.psel;
+        if( rise ) {
+            frames++;
+            out[0] = lr[0];
+            out[1] = lr[1];
+            if( !restored && frames<=QSND_INIT_FRAMES ) {
+                init_audio.push_back( lr[0] );
+                init_audio.push_back( lr[1] );
+                if( frames==QSND_INIT_FRAMES ) {
+                    io.rom_log = nullptr;
+                    if( n==cmdlist.cbegin() ) save_init();
+                    init_reads.clear();
+                }
+            }
+            return;
+        }
+    }
+}
+
+// Plays the command list, and then goes on up to -mintime
+int play_emu( const ParseArgs& args, int16_t* rom ) {
+    QSndData samples( args.qsnd_rom.c_str() );
+    QSCmd cmd( args.playfile );
+    auto cmdlist = cmd.cmdlist();
+    WaveWritter wav( args.wav_file, QSOUND_RATE, false, args.audio_format, args.flush_samples );
+    QSndPlayer player( rom, samples, cmdlist, emu_engine( args ), args.verbose );
+
+    auto t0 = std::chrono::steady_clock::now();
+    int64_t frames=0;
+    int16_t lr[2];
+    while( !player.cmd_done() || player.ms()<args.min_sim_time ) {
+        player.next_frame( lr );
+        wav.write( lr );
+        frames++;
+    }
+    wav.flush();
+    double wall = std::chrono::duration<double>( std::chrono::steady_clock::now()-t0 ).count();
+    double audio = frames/QSOUND_RATE;
+    printf("%ld samples (%.1f s) rendered in %.1f s, %.1fx real time\n",
+        (long)frames, audio, wall, wall>0 ? audio/wall : 0 );
+    return 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __EVENTSCHED_H
+#define __EVENTSCHED_H
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+// Discrete event scheduler for the simulation harness. Time is counted
+// in DSP clock cycles. Timed events are kept in a min-heap and run in
+// order; events set for the same cycle run in the order they were added.
+// Signals with a known timing are timed events. The ones driven by the
+// firmware at any time are checked by the step function given to run(),
+// once per cycle
+class EventSched {
+public:
+    typedef std::function<void()> Action;
+private:
+    struct Event {
+        int64_t  when;
+        uint64_t seq;
+        Action   action;
+        bool operator>( const Event& e ) const {
+            return when!=e.when ? when>e.when : seq>e.seq;
+        }
+    };
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    int64_t  now;
+    uint64_t seq;
+    bool     stopped;
+public:
+    EventSched() : now(0), seq(0), stopped(false) {}
+    int64_t time() const { return now; }
+    void at( int64_t when, Action a ) {
+        if( when<now ) when=now;
+        events.push( {when, seq++, a} );
+    }
+    void after( int64_t delay, Action a ) { at( now+delay, a ); }
+    void stop() { stopped=true; }
+    // Runs until stop() is called or there are no events left. step
+    // advances the simulation by one cycle and polls the firmware
+    // driven signals. It is a template argument, so it is called
+    // directly. The events due run before the step of their cycle
+    template<class Step> void run( Step step );
+};
+
+template<class Step> void EventSched::run( Step step ) {
+    stopped = false;
+    while( true ) {
+        while( !stopped && !events.empty() && events.top().when<=now ) {
+            Action a = events.top().action;
+            events.pop();
+            a();
+        }
+        if( stopped || events.empty() ) break;
+        step();
+        now++;
+    }
+}
+
+#endif
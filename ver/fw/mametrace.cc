@@ -3,22 +3,100 @@
 #include <string>
 #include <cstring>
 #include <cstdlib>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
 MAMEtrace::MAMEtrace( const char *file_name ) {
-    fin.open(file_name);
+    map = cur = end = nullptr;
+    map_len = 0;
+    if( is_binary(file_name) )
+        open_bin( file_name );
+    else
+        fin.open(file_name);
     line_cnt=0;
     next();
 }
 
+MAMEtrace::~MAMEtrace() {
+    if( map!=nullptr ) munmap( (void*)map, map_len );
+    map = nullptr;
+}
+
+bool MAMEtrace::is_binary( const char *file_name ) {
+    ifstream f( file_name, ios_base::binary );
+    char m[8];
+    f.read( m, 8 );
+    return f.good() && memcmp( m, MAMETRACE_MAGIC, 8 )==0;
+}
+
+void MAMEtrace::open_bin( const char *file_name ) {
+    int fd = open( file_name, O_RDONLY );
+    if( fd<0 ) throw runtime_error(string("Cannot open trace file ")+file_name);
+    struct stat st;
+    if( fstat( fd, &st )!=0 || (size_t)st.st_size<MAMETRACE_HEADER ) {
+        close(fd);
+        throw runtime_error(string("Cannot read trace file ")+file_name);
+    }
+    map_len = st.st_size;
+    void *m = mmap( nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);
+    if( m==MAP_FAILED ) throw runtime_error(string("Cannot map trace file ")+file_name);
+    map = (const char*)m;
+    madvise( m, map_len, MADV_SEQUENTIAL );
+    uint32_t version, rec_size;
+    memcpy( &version,  map+8,  sizeof(version) );
+    memcpy( &rec_size, map+12, sizeof(rec_size) );
+    if( version!=MAMETRACE_VERSION || rec_size!=sizeof(CPUstate) ) {
+        munmap( m, map_len );
+        map = nullptr;
+        throw runtime_error(string("Unsupported binary trace format in ")+file_name);
+    }
+    cur = map+MAMETRACE_HEADER;
+    // a partial record at the end is ignored
+    end = cur + (map_len-MAMETRACE_HEADER)/sizeof(CPUstate)*sizeof(CPUstate);
+}
+
 bool MAMEtrace::next() {
+    return map!=nullptr ? next_bin() : next_text();
+}
+
+bool MAMEtrace::next_bin() {
+    if( cur>=end ) return false;
+    CPUstate st;
+    memcpy( &st, cur, sizeof(st) );
+    cur += sizeof(st);
+    pc = st.pc; pt = st.pt; pr = st.pr; pi = st.pi;
+    i  = st.i;  r0 = st.r0; r1 = st.r1; r2 = st.r2; r3 = st.r3; rb = st.rb; re = st.re;
+    j  = st.j;  k  = st.k;  x  = st.x;  y  = st.y;
+    p  = st.p;  a0 = st.a0; a1 = st.a1;
+    c0 = st.c0; c1 = st.c1; c2 = st.c2; auc = st.auc; psw = st.psw;
+    line_cnt++;
+    return true;
+}
+
+int MAMEtrace::size() const {
+    return map==nullptr ? 0 : (end-map-MAMETRACE_HEADER)/sizeof(CPUstate);
+}
+
+// makes the given line the current one
+bool MAMEtrace::seek( int line ) {
+    if( map==nullptr ) throw runtime_error("Only binary traces can be seeked");
+    if( line<1 || line>size() ) return false;
+    cur = map+MAMETRACE_HEADER+(size_t)(line-1)*sizeof(CPUstate);
+    line_cnt = line-1;
+    return next_bin();
+}
+
+bool MAMEtrace::next_text() {
     if( !fin.good() ) return false;
     string line;
     getline( fin, line );
     if( !fin.good() || fin.eof() ) return false;
-    char *tok = new char[ line.size()+1 ];
-    strcpy( tok, line.c_str() );
     sscanf( line.c_str(),
         "pc=%X pt=%X pr=%X pi=%X "
         "i=%X r0=%X r1=%X r2=%X r3=%X rb=%X re=%X "
@@ -34,6 +112,15 @@ bool MAMEtrace::next() {
     return true;
 }
 
+void MAMEtrace::get_state( CPUstate& st ) const {
+    memset( &st, 0, sizeof(st) );
+    st.pc = pc; st.pt = pt; st.pr = pr; st.pi = pi;
+    st.i  = i;  st.r0 = r0; st.r1 = r1; st.r2 = r2; st.r3 = r3; st.rb = rb; st.re = re;
+    st.j  = j;  st.k  = k;  st.x  = x;  st.y  = y;
+    st.p  = p;  st.a0 = a0; st.a1 = a1;
+    st.c0 = c0; st.c1 = c1; st.c2 = c2; st.auc = auc; st.psw = psw;
+}
+
 void MAMEtrace::dump() {
     printf(
         "pc=%X pt=%X pr=%X pi=%X "
@@ -46,4 +133,4 @@ void MAMEtrace::dump() {
         j, k, x, y,
         p, a0, a1,
         c0, c1, c2, auc, psw );
-}
\ No newline at end of file
+}
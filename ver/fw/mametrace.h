@@ -1,6 +1,7 @@
 #ifndef __MAMETRACE_H
 #define __MAMETRACE_H
 
+#include <cstdint>
 #include <fstream>
 
 struct CPUstate {
@@ -10,17 +11,37 @@ struct CPUstate {
     int64_t a0, a1;
 };
 
+// Binary traces are a header with the magic string, the version and
+// the record size, followed by one CPUstate per traced instruction
+const char MAMETRACE_MAGIC[]="MAMETRAC";
+const uint32_t MAMETRACE_VERSION=1;
+const size_t MAMETRACE_HEADER=8+2*sizeof(uint32_t);
+
+// Reads text traces from MAME or binary traces made with tr2bin.
+// Binary traces are memory mapped and read without parsing
 class MAMEtrace {
     std::ifstream fin;
     int line_cnt;
+    const char *map, *cur, *end;
+    size_t map_len;
+    bool next_text();
+    bool next_bin();
+    void open_bin( const char *file_name );
 public:
     int pc, pt, pr, pi, i, r0, r1, r2, r3, rb, re, j, k, x, y, p;
     int c0, c1, c2, auc, psw;
     int64_t a0, a1;
     MAMEtrace( const char *file_name );
+    ~MAMEtrace();
     void dump();
     bool next();
+    void get_state( CPUstate& st ) const;
     int get_line() const { return line_cnt; }
+    // random access, only for binary traces. Lines count from 1
+    bool binary() const { return map!=nullptr; }
+    int  size() const;
+    bool seek( int line );
+    static bool is_binary( const char *file_name );
 };
 
-#endif
\ No newline at end of file
+#endif
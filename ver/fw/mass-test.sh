@@ -1,8 +1,6 @@
 #FIRST=$RANDOM
 FIRST=1
-LAST=$((FIRST+1000))
+SEEDS=1000
 
-# first run once to compile if needed
-sim.sh
-# now run the batch
-seq $FIRST 1 $LAST | parallel sim.sh | grep ERROR
+# all seeds run in a single process, one test per core
+sim.sh -fuzz $SEEDS $FIRST $*
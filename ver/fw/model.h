@@ -2,6 +2,7 @@
 #define __FWMODEL_H
 
 #include "dsp16_model.h"
+#include "snapshot.h"
 
 #include <cstdlib>
 #include <exception>
@@ -51,6 +52,27 @@ public:
     int fault() { return st.fault; }
     // status access
     bool in_cache() { return st.cache.k>0; }
+    // snapshots. The structure sizes are stored to catch dsp16_model.h changes
+    void save( std::ostream& os ) {
+        SnapWriter w( os, "DSP16MDL", 1 );
+        w.put( (uint32_t)sizeof(DSP16) );
+        w.put( (uint32_t)sizeof(DSP16_in) );
+        w.put( st );
+        w.put( inputs );
+        w.put_array( ram, 0x1000*sizeof(i16) );
+        if( !w.good() ) throw std::runtime_error("Cannot write the model snapshot");
+    }
+    void load( std::istream& is ) {
+        SnapReader r( is, "DSP16MDL", 1 );
+        uint32_t st_size, in_size;
+        r.get( st_size );
+        r.get( in_size );
+        if( st_size!=sizeof(DSP16) || in_size!=sizeof(DSP16_in) )
+            throw std::runtime_error("The model snapshot was made with another dsp16_model.h");
+        r.get( st );
+        r.get( inputs );
+        r.get_array( ram, 0x1000*sizeof(i16) );
+    }
 };
 
 #define CHECK( a, M ) if( (ref.a()&M) != (dut.a()&M) ) good=false;
@@ -106,7 +128,10 @@ class Dual {
         }
             side_dump();
         if( !good ) {
-            if( bad==0 ) printf("qqqqqqqqqqqqqqqqqqqqq\n");
+            if( bad==0 ) {
+                printf("qqqqqqqqqqqqqqqqqqqqq\n");
+                dut.flush_history();
+            }
             if( ++bad > 4 )
                 throw std::runtime_error("Error: Ref and DUT diverged\n");
         }
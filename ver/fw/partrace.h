@@ -0,0 +1,232 @@
+#ifndef __PARTRACE_H
+#define __PARTRACE_H
+
+#include "DSP16emu.h"
+#include "mametrace.h"
+#include "qsnd.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Parallel comparison of the emulator against a binary MAME trace.
+// Each trace line is the state before one instruction. The emulator
+// state is saved every few lines in a checkpoint file next to the trace.
+// The segments between checkpoints are then compared on their own
+// threads, and the first diverging line among all of them is reported.
+// The first run has no checkpoints yet, so it compares the whole trace
+// on one thread while it makes them. The RTL cannot be restored from a
+// snapshot, so only the emulator is checked this way
+
+// The checkpoint layout is in the high half of the version and the
+// emulator snapshot version in the low half, so both invalidate old files
+const char     CKPT_MAGIC[]   = "DSP16CKP";
+const uint32_t CKPT_FORMAT    = 2;
+const uint32_t CKPT_VERSION   = (CKPT_FORMAT<<16) | DSP16EMU_SNAP_VERSION;
+
+// FNV-1a, identifies the ROM and trace the checkpoints were made from
+uint64_t ckpt_hash( const void *buf, size_t len, uint64_t h=0xcbf29ce484222325ULL ) {
+    auto p = (const uint8_t*)buf;
+    for( size_t k=0; k<len; k++ ) {
+        h ^= p[k];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// The header and the first record of the trace, after the program ROM
+uint64_t ckpt_source( ROM& rom, const std::string& trace_file ) {
+    uint64_t h = ckpt_hash( rom.data(), 8*1024 );
+    std::ifstream fin( trace_file, std::ios_base::binary );
+    char head[MAMETRACE_HEADER+sizeof(CPUstate)];
+    fin.read( head, sizeof(head) );
+    return ckpt_hash( head, fin.gcount(), h );
+}
+
+bool compare( DSP16emu& emu, MAMEtrace& tr );
+
+class TraceCheckpoints {
+    std::vector<std::string> states; // state before line k*segment+1
+public:
+    int segment, lines;
+    uint64_t source; // ckpt_source() of the ROM and trace
+    TraceCheckpoints() : segment(0), lines(0), source(0) {}
+    bool load( const std::string& fname, uint64_t _source, int _segment, int _lines );
+    void save( const std::string& fname );
+    int  make( DSP16code* code, QSndData& samples, DSP16engine engine, MAMEtrace& tr,
+               uint64_t _source, int _segment, int _lines );
+    int  size() const { return states.size(); }
+    void restore( int k, DSP16emu& emu ) const {
+        std::istringstream is( states[k] );
+        emu.load( is );
+    }
+};
+
+// Checkpoints are only reused if they were made from the same ROM and trace,
+// for the same segment length. Unreadable or old files are made again
+bool TraceCheckpoints::load( const std::string& fname, uint64_t _source, int _segment, int _lines ) {
+    std::ifstream fin( fname, std::ios_base::binary );
+    if( !fin.good() ) return false;
+    try {
+        SnapReader r( fin, CKPT_MAGIC, CKPT_VERSION );
+        uint32_t n;
+        r.get( source );
+        r.get( segment );
+        r.get( lines );
+        r.get( n );
+        if( source!=_source || segment!=_segment || lines!=_lines ) return false;
+        states.resize( n );
+        for( auto& s : states ) {
+            uint32_t len;
+            r.get( len );
+            s.resize( len );
+            r.get_array( &s[0], len );
+        }
+    } catch( const std::exception& e ) {
+        printf("Ignoring %s: %s\n", fname.c_str(), e.what() );
+        states.clear();
+        return false;
+    }
+    return true;
+}
+
+void TraceCheckpoints::save( const std::string& fname ) {
+    std::ofstream fout( fname, std::ios_base::binary );
+    SnapWriter w( fout, CKPT_MAGIC, CKPT_VERSION );
+    w.put( source );
+    w.put( segment );
+    w.put( lines );
+    w.put( (uint32_t)states.size() );
+    for( auto& s : states ) {
+        w.put( (uint32_t)s.size() );
+        w.put_array( s.data(), s.size() );
+    }
+    if( !w.good() ) throw std::runtime_error("Cannot write "+fname);
+}
+
+// Compares the whole trace sequentially, saving the state every segment
+// lines. Returns the first line that differs, or lines+1. The checkpoints
+// are only complete if all lines match
+int TraceCheckpoints::make( DSP16code* code, QSndData& samples, DSP16engine engine, MAMEtrace& tr,
+        uint64_t _source, int _segment, int _lines ) {
+    source  = _source;
+    segment = _segment;
+    lines   = _lines;
+    int16_t *ram = new int16_t[2048];
+    DSP16emu emu( code, ram, engine );
+    QSndIO io( samples, emu );
+    emu.io = &io;
+    states.clear();
+    int line=1;
+    for( tr.seek(1); line<=lines; line++, tr.next() ) {
+        if( (line-1)%segment==0 ) {
+            std::ostringstream os;
+            emu.save( os );
+            states.push_back( os.str() );
+        }
+        if( !compare( emu, tr ) ) break;
+        emu.eval();
+    }
+    delete[] ram;
+    return line;
+}
+
+#define CHECK( a ) if( emu.a != tr.a ) return false;
+
+bool compare( DSP16emu& emu, MAMEtrace& tr ) {
+    CHECK( r0 );
+    CHECK( r1 );
+    CHECK( r2 );
+    CHECK( r3 );
+    CHECK( rb );
+    CHECK( re );
+    CHECK( i );
+    CHECK( j );
+    CHECK( k );
+    CHECK( x );
+    int y = (emu.y<<16)|(emu.yl&0xffff);
+    if( y != tr.y ) return false;
+    CHECK( p );
+    CHECK( a0 );
+    CHECK( a1 );
+    return true;
+}
+
+#undef CHECK
+
+int cmptrace_emu( ParseArgs& args ) {
+    ROM rom;
+    QSndData samples("wof.rom");
+    MAMEtrace tr( args.trace_file.c_str() );
+    if( !tr.binary() )
+        throw std::runtime_error("The parallel trace comparison needs a binary trace. Use tr2bin");
+    const int lines = tr.size();
+    const int segment = args.segment;
+    DSP16code *code = new DSP16code;
+    DSP16emu::predecode( *code, rom.data() );
+
+    DSP16engine engine = args.threaded ? ENGINE_THREADED : ENGINE_SWITCH;
+    TraceCheckpoints ckpt;
+    std::string ckpt_file = args.trace_file+".ckpt";
+    uint64_t source = ckpt_source( rom, args.trace_file );
+    if( ckpt.load( ckpt_file, source, segment, lines ) ) {
+        printf("Using %d checkpoints from %s\n", ckpt.size(), ckpt_file.c_str() );
+    } else {
+        printf("Comparing on one thread while making checkpoints every %d lines\n", segment );
+        int bad = ckpt.make( code, samples, engine, tr, source, segment, lines );
+        delete code;
+        if( bad <= lines ) {
+            printf("Diverged at line %d\n", bad );
+            return 1;
+        }
+        ckpt.save( ckpt_file );
+        printf("comparison found no differences in %d lines. Later runs use %s\n",
+            lines, ckpt_file.c_str() );
+        return 0;
+    }
+
+    // segments after a known divergence are skipped
+    std::atomic<int> next_seg(0), first_bad(lines+1);
+    auto worker = [&]() {
+        int16_t *ram = new int16_t[2048];
+        DSP16emu emu( code, ram, engine );
+        QSndIO io( samples, emu );
+        emu.io = &io;
+        MAMEtrace seg_tr( args.trace_file.c_str() );
+        int s;
+        while( (s=next_seg++) < ckpt.size() ) {
+            int line = s*segment+1;
+            if( line >= first_bad ) break;
+            int last = std::min( line+segment, lines+1 );
+            ckpt.restore( s, emu );
+            for( seg_tr.seek(line); line<last; line++, seg_tr.next() ) {
+                if( !compare( emu, seg_tr ) ) {
+                    int bad = first_bad;
+                    while( line<bad && !first_bad.compare_exchange_weak( bad, line ) );
+                    break;
+                }
+                emu.eval();
+            }
+        }
+        delete[] ram;
+    };
+    int jobs = args.jobs>0 ? args.jobs : (int)std::max( 1u, std::thread::hardware_concurrency() );
+    jobs = std::max( 1, std::min( jobs, ckpt.size() ) );
+    std::vector<std::thread> pool;
+    for( int k=0; k<jobs; k++ ) pool.emplace_back( worker );
+    for( auto& t : pool ) t.join();
+    delete code;
+
+    if( first_bad <= lines ) {
+        printf("Diverged at line %d\n", (int)first_bad );
+        return 1;
+    }
+    printf("comparison found no differences in %d lines (%d jobs)\n", lines, jobs );
+    return 0;
+}
+
+#endif
@@ -1,27 +1,18 @@
 #include "common.h"
 #include "vcd.h"
 #include "mametrace.h"
+#include "qsnd.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <cstdio>
 #include <vector>
 #include <string>
-#include "WaveWritter.h"
 #include "model.h"
+#include "eventsched.h"
 
 using namespace std;
 
-class QSndData {
-    int get_offset( char *header, int p );
-    int mask;
-    char *data;
-public:
-    QSndData( const char *rompath );
-    int get( int addr );
-    ~QSndData();
-};
-
 class QSndLog {
     struct LogPair{ long int ticks; int value; };
 public:
@@ -29,10 +20,11 @@ public:
 };
 
 int play_timeval( ROM& rom, RTL& rtl, QSndData& samples, const VCDsignal::pointlist& cmdlist,
-    bool allcmd, int min_sim_time ) {
-    int reads;
+    const ParseArgs& args ) {
+    const bool allcmd = args.allcmd;
+    const int min_sim_time = args.min_sim_time;
     auto n = cmdlist.cbegin();
-    WaveWritter wav("out.wav", 24000, false );
+    WaveWritter wav( args.wav_file, QSOUND_RATE, false, args.audio_format, args.flush_samples );
 
     Model ref(rom);
     Dual dual( ref, rtl );
@@ -45,92 +37,144 @@ int play_timeval( ROM& rom, RTL& rtl, QSndData& samples, const VCDsignal::pointl
 
     dual.clk( 200'000 ); // initialization
 
+    EventSched sched;
 
     int sim_time=0;
-    int last_pids=1, last_psel=1, last_sadd=1, last_pods=1;
+    int newcmd=0, reads=0, irq=0;
+    bool waiting=false; // a command is due but the last IRQ is not processed yet
     int rom_addr=0;
     int bank=0;
+    int64_t last_rom=-1;
+    int16_t lr[2]={0,0};
 
-    // Sample interval measurement
-    int sample_t0 = 0;
-    int sample_t1 = 0;
-    int last_pc=0;
-    int64_t ticks=0;
-    do {
-        int newcmd = n->val;
-        int reads=0;
-        int irq=1;
+    // Sample boundaries. The first psel rise sets the phase. After that
+    // they are timed events SAMPLE_CYCLES apart, and psel is no longer
+    // polled. Each boundary checks that psel rises in that cycle, or the
+    // phase is looked for again
+    bool locked=false;
+    int  psel_before=0;
+
+    // External ROM reads. The bank is taken from ab one cycle late,
+    // so the read is repeated on the next cycle when the bank changes
+    std::function<void()> read_rom = [&]() {
+        if( last_rom==sched.time() || !(rtl.ab()&0x8000) ) return;
+        last_rom = sched.time();
+        int new_bank = qsnd_bank( rtl.ab() );
+        rom_addr = qsnd_rom_addr( bank, rom_addr );
+        int din = samples.get( rom_addr );
+        dual.rb_din( din<<8 );
+        //printf("Read %X from %06X\n", din, rom_addr );
+        if( new_bank != bank ) {
+            bank = new_bank;
+            sched.after( 1, read_rom );
+        }
+    };
 
-        dual.set_irq(irq);
-        dual.pbus_in( newcmd>>16 );
+    std::function<void()> send_cmd = [&]() {
+        if( irq || rtl.iack() ) { // stay here until IRQ is processed
+            waiting = true;
+            return;
+        }
+        waiting = false;
+        if( sim_time >= 500'800 && !(allcmd && sim_time>min_sim_time) ) {
+            sched.stop();
+            return;
+        }
         sim_time = (int)(rtl.time()/1000'000L);
         int64_t steps=0;
         if( n==cmdlist.cend() ) {
             printf("All VCD data points have been parsed\n");
             if( sim_time > min_sim_time ) {
-                break;
-            } else {
-                printf("Simulating up to %d ms\n",min_sim_time);
-                steps = (min_sim_time-sim_time)*1000'0000/18;
+                sched.stop();
+                return;
             }
+            printf("Simulating up to %d ms\n",min_sim_time);
+            steps = (int64_t)(min_sim_time-sim_time)*1000'0000/18;
         } else {
+            newcmd = n->val;
+            reads = 0;
+            irq = 1;
+            dual.set_irq(irq);
+            dual.pbus_in( newcmd>>16 );
             printf("%d ms -> %02X_%04X\n", sim_time, newcmd>>16, newcmd&0xffff);
             n++;
             vcdtime = next;
-            next = n->time;
+            if( n!=cmdlist.cend() ) next = n->time;
             steps = (next-vcdtime)/18;
         }
-        int16_t lr[2];
-        while( steps>0 || irq==1 || rtl.iack() ) { // stay here until IRQ is processed
-            dual.clk(2);
-            ticks++;
-            const int LOOP_PC=0x55e;
-            if( rtl.pc()==LOOP_PC && last_pc!=LOOP_PC ) {
-                sample_t0 = sample_t1;
-                sample_t1 = ticks;
-                int interval = sample_t1-sample_t0;
-                if( interval!=1250)
-                    printf("Sample ticks %d != 1250 (ticks %ld)\n", interval, ticks);
-            }
-            last_pc = rtl.pc();
-            if( rtl.pids()==1 && last_pids==0 ) {
-                reads++;
-                if( reads==1 ) dual.pbus_in( newcmd&0xffff );
-            }
-            if( !rtl.sadd() && last_sadd ) {
-                lr[ rtl.psel() ? 1 :0 ] = rtl.ser_out();
-            }
-            if( !last_psel && rtl.psel() ) {
-                wav.write( lr );
-            }
-            if( last_pids==0 ) {
+        sched.after( (steps+1)>>1, send_cmd ); // two steps per clock cycle
+    };
+
+    auto release = [&]() {
+        if( waiting && !irq && !rtl.iack() ) send_cmd();
+    };
+
+    // Signals driven by the firmware at any time are polled. They are
+    // packed in one word, so a cycle without changes costs one comparison
+    const int PIN_PIDS=1, PIN_SADD=2, PIN_PODS=4, PIN_IACK=8, PIN_PSEL=16;
+    auto pins = [&]() {
+        return (rtl.pids() ? PIN_PIDS : 0) | (rtl.sadd() ? PIN_SADD : 0) |
+               (rtl.pods() ? PIN_PODS : 0) | (rtl.iack() ? PIN_IACK : 0) |
+               (!locked && rtl.psel() ? PIN_PSEL : 0);
+    };
+    int last_pins = pins(), last_ab = rtl.ab();
+
+    std::function<void()> sample = [&]() {
+        if( psel_before || !rtl.psel() ) {
+            printf("Sample boundary lost at cycle %ld\n", (long)sched.time() );
+            locked = false;
+            if( rtl.psel() ) last_pins |= PIN_PSEL; // wait for the next rise
+            return;
+        }
+        wav.write( lr );
+        sched.after( SAMPLE_CYCLES-1, [&]() { psel_before = rtl.psel(); } );
+        sched.after( SAMPLE_CYCLES, sample );
+    };
+
+    auto step = [&]() {
+        dual.clk(2);
+        int now_pins = pins();
+        int ab = rtl.ab();
+        if( now_pins==last_pins && ab==last_ab ) return;
+        int rise = now_pins & ~last_pins;
+        int fall = last_pins & ~now_pins;
+        last_pins = now_pins;
+        if( rise & PIN_PIDS ) {
+            reads++;
+            if( reads==1 ) dual.pbus_in( newcmd&0xffff );
+        }
+        if( fall & PIN_PIDS ) {
+            sched.after( 1, [&]() { // IRQ deassertion
                 dual.set_irq(0);
                 irq=0;
-            }
-            if( rtl.pods()==1 && last_pods==0 ) {
-                rom_addr &= 0xFF'0000;
-                rom_addr |= rtl.pbus_out()&0xFFFF;
-                //if( rtl.ser_out() != 0 ) {
-                //    if( !rtl.vcd_dump ) printf("** Enabling VCD dumping\n");
-                //    rtl.vcd_dump=true;
-                //}
-            }
-            if( rtl.ab()&0x8000 ) { // update the value only when external reads occur
-                int new_bank = rtl.ab()&0x7f;
-                rom_addr &= 0xFFFF;
-                rom_addr |= bank<<16;
-                bank = new_bank;
-                int din = samples.get( rom_addr );
-                dual.rb_din( din<<8 );
-                //printf("Read %X from %06X\n", din, rom_addr );
-            }
-            last_pids = rtl.pids();
-            last_psel = rtl.psel();
-            last_sadd = rtl.sadd();
-            last_pods = rtl.pods();
-            steps-=2;
+                release();
+            });
+        }
+        if( fall & PIN_SADD ) lr[ rtl.psel() ? 1 :0 ] = rtl.ser_out();
+        if( rise & PIN_PSEL ) { // the first boundary
+            locked = true;
+            psel_before = 0;
+            wav.write( lr );
+            // events see the state left by the step of the cycle before
+            sched.after( SAMPLE_CYCLES, [&]() { psel_before = rtl.psel(); } );
+            sched.after( SAMPLE_CYCLES+1, sample );
+            last_pins &= ~PIN_PSEL;
         }
-    }while( sim_time < 500'800 || (allcmd && sim_time>min_sim_time ) );
+        if( rise & PIN_PODS ) {
+            rom_addr &= 0xFF'0000;
+            rom_addr |= rtl.pbus_out()&0xFFFF;
+            last_rom = -1;
+            read_rom();
+        }
+        if( ab != last_ab ) {
+            last_ab = ab;
+            read_rom();
+        }
+        if( (rise|fall) & PIN_IACK ) release();
+    };
+
+    sched.at( 0, send_cmd );
+    sched.run( step );
     cout << "\n\nsim_time=" << sim_time << " min_sim_time="<<min_sim_time<<'\n';
     rtl.dump_ram();
 
@@ -139,11 +183,13 @@ int play_timeval( ROM& rom, RTL& rtl, QSndData& samples, const VCDsignal::pointl
 
 int playfiles( const ParseArgs& args ) {
     RTL rtl(args.vcd_file.c_str());
+    rtl.backdoor &= !args.port_load;
     ROM rom;
     QSndData samples(args.qsnd_rom.c_str());
     rtl.read_rom(rom.data());
     rtl.vcd_dump = args.write_vcd;
-    VCDfile stim("punisher.vcd"); // VCD sample input from CPS 1.5 ver/game folder
+    if( args.history ) rtl.keep_history( args.history );
+    VCDfile stim("punisher.vcd", {"cpu2dsp_s"}); // VCD sample input from CPS 1.5 ver/game folder
     stim.report();
     // Move until rst is low
     //printf("VCD forwarded to %ld\n",  );
@@ -151,19 +197,21 @@ int playfiles( const ParseArgs& args ) {
 
     // VCDsignal* sig_irq = stim.get("dsp_irq");
     VCDsignal* sig_cpu2dsp = stim.get("cpu2dsp_s");
-    auto& cmdlist = sig_cpu2dsp->get_list();
+    auto cmdlist = sig_cpu2dsp->get_list();
 
-    return play_timeval( rom, rtl, samples, cmdlist, args.allcmd, args.min_sim_time );
+    return play_timeval( rom, rtl, samples, cmdlist, args );
 }
 
 int play_qs( const ParseArgs& args ) {
     RTL rtl(args.vcd_file.c_str());
+    rtl.backdoor &= !args.port_load;
     ROM rom;
     QSndData samples(args.qsnd_rom.c_str());
     rtl.vcd_dump = args.write_vcd;
+    if( args.history ) rtl.keep_history( args.history );
     rtl.read_rom(rom.data());
     QSCmd cmd(args.playfile);
-    return play_timeval( rom, rtl, samples, cmd.cmdlist(), args.allcmd, args.min_sim_time );
+    return play_timeval( rom, rtl, samples, cmd.cmdlist(), args );
 }
 
 #define CHECK( a ) if( rtl.a() != tr.a ) { /*printf("Register " #a " is wrong\n");*/ return false; }
@@ -223,8 +271,7 @@ void handle_din( RTL& rtl, int& rom_addr, QSndData& samples ) {
         rom_addr = 0;
         rom_addr |= rtl.pbus_out()&0xFFFF;
     }
-    rom_addr &= 0xFFFF;
-    rom_addr |= (rtl.ab()&0xff)<<16;
+    rom_addr = qsnd_rom_addr( rtl.ab(), rom_addr );
     if( rtl.ab()&0x8000 ) { // update the value only when external reads occur
         int din = samples.get( rom_addr );
         //printf("Read %X from %X\n", din, rom_addr );
@@ -234,10 +281,12 @@ void handle_din( RTL& rtl, int& rom_addr, QSndData& samples ) {
 
 int cmptrace( ParseArgs& args ) {
     RTL rtl(args.vcd_file.c_str());
+    rtl.backdoor &= !args.port_load;
     ROM rom;
     QSndData samples("wof.rom");
     rtl.read_rom(rom.data());
     MAMEtrace tr( args.trace_file.c_str() );
+    if( args.history ) rtl.keep_history( args.history );
     // Move until rst is low
     //printf("VCD forwarded to %ld\n",  );
     //int64_t vcdtime = stim.forward("dsp_rst",0);
@@ -262,6 +311,7 @@ int cmptrace( ParseArgs& args ) {
                 continue; // give an extra cycle
             } else {
                 printf("Diverged at line %d\n", line_bad);
+                rtl.flush_history();
                 //sidebyside( rtl, tr );
                 rtl.clk(4); // Add some extra cycles
                 return 1;
@@ -278,56 +328,3 @@ int cmptrace( ParseArgs& args ) {
     printf("comparison found no differences\n");
     return 0;
 }
-
-QSndData::QSndData( const char *rompath ) {
-    ifstream fin(rompath, ios_base::binary);
-    if( !fin.good() ) {
-        stringstream ss;
-        ss << "Cannot open ROM file " << rompath;
-        throw runtime_error(ss.str());
-    }
-    // Get the header
-    char header[64];
-    fin.read( header, 64 );
-    if( !fin.good() ) throw runtime_error("Cannot read ROM header");
-    int start = get_offset( header, 2 );
-    int end   = get_offset( header, 4 );
-    int expected = end-start;
-    if( expected>8*1024*1024 )
-        expected = 8*1024*1024;
-    data = new char[expected];
-    mask = expected-1;
-    cout << "Reading " << rompath << '\n';
-    printf("PCM data start %10X\nPCM data end   %10X. Mask=%0x\n", start, end, mask );
-    fin.seekg( start+64 );
-    if( !fin.good() ) {
-        char s[256];
-        sprintf(s,"Cannot seek to PCM start of game ROM (%X)", start);
-        throw runtime_error(s);
-    }
-    fin.read( data, expected );
-    int data_cnt = fin.gcount();
-    if( data_cnt!=expected ) {
-        char s[256];
-        sprintf(s,"Expected 0x%X bytes of data but only 0x%X were read", expected, data_cnt );
-        throw runtime_error(s);
-    }
-    printf("Read %d (%d MB) as PCM data\n", data_cnt, data_cnt>>20 );
-}
-
-QSndData::~QSndData() {
-    delete[] data;
-    data = nullptr;
-}
-
-int QSndData::get( int addr ) {
-    addr &= mask;
-    return data[addr]&0xff;
-}
-
-int QSndData::get_offset( char *header, int p ) {
-    int o = ((((int)header[p+1])&0xff)<<8) | (((int)header[p])&0xff);
-    // printf("%X%X->%X\n", (unsigned)header[p+1]&0xff, (unsigned)header[p]&0xff, o);
-    o <<= 10;
-    return o;
-}
\ No newline at end of file
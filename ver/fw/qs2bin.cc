@@ -0,0 +1,53 @@
+// Converts QSound command lists to the binary .qsb format
+// Build with: g++ -O2 qs2bin.cc qscmd.cc vcd.cc -o qs2bin
+//
+// qs2bin input.qs output.qsb
+// qs2bin input.vcd output.qsb [signal]   the signal defaults to cpu2dsp_s
+
+#include "qscmd.h"
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+const uint32_t SAMPLE_RATE=48'000;
+const int64_t  SAMPLE_NS=20'833; // as used for .qs files
+
+bool ends_with( const string& s, const string& end ) {
+    return s.size()>=end.size() && s.compare( s.size()-end.size(), end.size(), end )==0;
+}
+
+int main( int argc, char *argv[] ) {
+    if( argc<3 ) {
+        cout << "Usage: qs2bin input.qs|input.vcd output.qsb [VCD signal]\n";
+        return 1;
+    }
+    try {
+        string in=argv[1], out=argv[2];
+        VCDsignal::pointlist points;
+        int64_t ref=0;
+        if( ends_with( in, ".vcd" ) ) {
+            string name = argc>3 ? argv[3] : "cpu2dsp_s";
+            VCDfile vcd( in.c_str(), {name} );
+            VCDsignal *sig = vcd.get(name);
+            if( sig==nullptr ) throw runtime_error("Cannot find signal "+name+" in "+in);
+            points = sig->get_list();
+        } else {
+            QSCmd cmd(in);
+            points = cmd.cmdlist();
+            ref = cmd.ref_sample();
+        }
+        QSBinWriter w( out, SAMPLE_RATE, ref );
+        // VCD times are rounded to the nearest sample
+        for( auto& p : points )
+            w.add( ref+(p.time+SAMPLE_NS/2)/SAMPLE_NS, (p.val>>16)&0xff, p.val&0xffff );
+        if( !w.good() ) throw runtime_error("Cannot write "+out);
+        printf("%d commands written to %s\n", (int)points.size(), out.c_str() );
+    } catch( const runtime_error& e ) {
+        printf("ERROR: %s\n",e.what());
+        return 1;
+    }
+    return 0;
+}
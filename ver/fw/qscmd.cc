@@ -0,0 +1,177 @@
+#include "qscmd.h"
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+QSCmd::QSCmd( const std::string& fname ) {
+    if( QSBinFile::is_binary(fname) ) {
+        QSBinFile bin(fname);
+        points.reserve( bin.size() );
+        for( auto& p : bin ) points.push_back( p );
+        ref = bin.ref_sample();
+        cout << "Read " << dec << points.size() << " data points\n";
+    } else {
+        parse_text(fname);
+    }
+    if( !points.empty() )
+        cout << "Final time=" << points.back().time/1000'000 << "ms\n";
+}
+
+void QSCmd::parse_text( const std::string& fname ) {
+    ifstream fin(fname);
+    if(!fin.good()) {
+        stringstream ss("Cannot open file ");
+        ss << fname;
+        throw runtime_error(ss.str());
+    }
+    string line;
+    bool first=true;
+    int ref_sample=10;
+    int skip=-1;
+    while( !fin.eof() ) {
+        getline(fin, line, '\n');
+        //cout << "0** " << line << "**\n";
+        if( fin.bad() ) {
+            cout << "ERROR: fin is bad\n";
+            break;
+        }
+
+        if( line.find('#')!= string::npos ) {
+            line = line.substr( 0, line.find_first_not_of(" \t#")-2 );
+        }
+        if( !line.size() ) {
+            skip++;
+            continue;
+        }
+        stringstream ss(line);
+        int sample, addr, cmd;
+        ss >> sample >> addr >> cmd;
+        if( first ) {
+            ref_sample = sample;
+            ref = sample;
+            first = false;
+        }
+        decltype(VCDpoint::time) time=(sample-ref_sample)*20'833LL;
+        int val = (addr<<16) | (cmd&0xffff);
+        points.push_back( {time, val} );
+    }
+    // for( auto p : points ) {
+    //     cout << dec << p.time/1000'000 << "ms   " << hex << p.val << "\n";
+    // }
+    cout << "Read " << dec << points.size() << " data points ("<<skip<<" skipped)\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+QSBinWriter::QSBinWriter( const std::string& fname, uint32_t sample_rate, int64_t ref_sample ) :
+        fout( fname, ios_base::binary ), w( fout, QSB_MAGIC, QSB_VERSION ) {
+    if( !fout.good() ) throw runtime_error("Cannot write "+fname);
+    w.put( sample_rate );
+    w.put( ref_sample );
+    last = ref_sample;
+}
+
+void QSBinWriter::add( int64_t sample, int addr, int data ) {
+    if( addr<0 || addr>0xff ) throw runtime_error("QSound command address out of range");
+    int64_t delta = sample-last;
+    last = sample;
+    uint64_t z = ((uint64_t)delta<<1) ^ (uint64_t)(delta>>63);
+    do {
+        uint8_t b = z&0x7f;
+        z >>= 7;
+        if( z ) b |= 0x80;
+        w.put( b );
+    } while( z );
+    w.put( (uint8_t)addr );
+    w.put( (uint8_t)(data&0xff) );
+    w.put( (uint8_t)((data>>8)&0xff) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool QSBinFile::is_binary( const std::string& fname ) {
+    ifstream fin( fname, ios_base::binary );
+    char m[8];
+    fin.read( m, 8 );
+    return fin.good() && memcmp( m, QSB_MAGIC, 8 )==0;
+}
+
+QSBinFile::QSBinFile( const std::string& fname ) {
+    int fd = open( fname.c_str(), O_RDONLY );
+    if( fd<0 ) throw runtime_error("Cannot open "+fname);
+    struct stat st;
+    const size_t hdr_len = 8+sizeof(uint32_t)*2+sizeof(int64_t);
+    if( fstat( fd, &st )!=0 || (size_t)st.st_size<hdr_len ) {
+        close(fd);
+        throw runtime_error("Not a QSound command file: "+fname);
+    }
+    len = st.st_size;
+    void *m = mmap( nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);
+    if( m==MAP_FAILED ) throw runtime_error("Cannot map "+fname);
+    map = (const char*)m;
+    uint32_t version;
+    memcpy( &version, map+8, sizeof(version) );
+    memcpy( &rate, map+12, sizeof(rate) );
+    memcpy( &ref, map+16, sizeof(ref) );
+    first = map+hdr_len;
+    last  = map+len;
+    if( memcmp( map, QSB_MAGIC, 8 )!=0 || version!=QSB_VERSION || rate==0 ) {
+        munmap( m, len );
+        throw runtime_error("Not a QSound command file: "+fname);
+    }
+    period = 1'000'000'000/rate; // ns
+    // check the records, so the iterator can trust them. A 64-bit delta
+    // takes at most ten LEB128 bytes
+    count = 0;
+    const char *p = first;
+    while( p<last ) {
+        const char *rec = p;
+        while( p<last && (*p&0x80) && p-rec<9 ) p++;
+        if( last-p<4 ) { // last LEB128 byte, address and data
+            munmap( m, len );
+            throw runtime_error("Truncated QSound command file: "+fname);
+        }
+        if( *p&0x80 ) {
+            munmap( m, len );
+            throw runtime_error("Bad sample delta at offset "+to_string(rec-map)+
+                " of QSound command file "+fname);
+        }
+        p += 4;
+        count++;
+    }
+}
+
+QSBinFile::~QSBinFile() {
+    munmap( (void*)map, len );
+    map = nullptr;
+}
+
+QSBinFile::const_iterator::const_iterator( const char *p, const char *e, int64_t per ) :
+        cur(p), next(p), end(e), sample(0), period(per) {
+    decode();
+}
+
+void QSBinFile::const_iterator::decode() {
+    if( cur>=end ) return;
+    const uint8_t *p = (const uint8_t*)cur;
+    uint64_t z=0;
+    int shift=0;
+    do {
+        z |= (uint64_t)(*p&0x7f) << shift;
+        shift += 7;
+    } while( *p++ & 0x80 );
+    sample += (int64_t)(z>>1) ^ -(int64_t)(z&1);
+    int addr = *p++;
+    int data = p[0] | (p[1]<<8);
+    next = (const char*)(p+2);
+    pt.time = sample*period;
+    pt.val  = (addr<<16) | data;
+}
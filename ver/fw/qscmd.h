@@ -0,0 +1,72 @@
+#ifndef __QSCMD_H
+#define __QSCMD_H
+
+#include "vcd.h"
+#include "snapshot.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// QSound command lists. They are read from text playfiles (.qs), where
+// each line has the sample number, the address and the data, or from
+// the compiled binary format (.qsb)
+class QSCmd {
+    VCDsignal::pointlist points;
+    int64_t ref=0;
+    void parse_text( const std::string& fname );
+public:
+    QSCmd( const std::string& fname );
+    const VCDsignal::pointlist cmdlist() const { return points; }
+    int64_t ref_sample() const { return ref; }
+};
+
+// Binary command streams. The header has the magic string, the version,
+// the sample rate and the reference sample. Each record then has the
+// sample offset from the previous record as a zig-zag LEB128 number, the
+// address byte and the 16-bit data in little endian order
+const char QSB_MAGIC[]="QSCMDBIN";
+const uint32_t QSB_VERSION=1;
+
+class QSBinWriter {
+    std::ofstream fout;
+    SnapWriter w;
+    int64_t last;
+public:
+    QSBinWriter( const std::string& fname, uint32_t sample_rate, int64_t ref_sample );
+    void add( int64_t sample, int addr, int data );
+    bool good() { return w.good(); }
+};
+
+// Memory mapped reader. Iterating over it gives the same VCDpoint
+// values that a VCDsignal::pointlist holds
+class QSBinFile {
+    const char *map, *first, *last;
+    size_t len;
+    uint32_t rate;
+    int64_t ref, period;
+    int count;
+public:
+    class const_iterator {
+        const char *cur, *next, *end;
+        int64_t sample, period;
+        VCDpoint pt;
+        void decode();
+    public:
+        const_iterator( const char *p, const char *e, int64_t per );
+        const VCDpoint& operator*()  const { return pt; }
+        const VCDpoint* operator->() const { return &pt; }
+        const_iterator& operator++() { cur=next; decode(); return *this; }
+        bool operator==( const const_iterator& o ) const { return cur==o.cur; }
+        bool operator!=( const const_iterator& o ) const { return cur!=o.cur; }
+    };
+    QSBinFile( const std::string& fname );
+    ~QSBinFile();
+    const_iterator begin() const { return const_iterator( first, last, period ); }
+    const_iterator end()   const { return const_iterator( last,  last, period ); }
+    uint32_t sample_rate() const { return rate; }
+    int64_t  ref_sample()  const { return ref; }
+    int size() const { return count; }
+    static bool is_binary( const std::string& fname );
+};
+
+#endif
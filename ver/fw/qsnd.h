@@ -0,0 +1,143 @@
+#ifndef __QSND_H
+#define __QSND_H
+
+#include "DSP16emu.h"
+#include "snapshot.h"
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// DSP cycles per output sample. The DSP runs at 60 MHz/2
+const int    SAMPLE_CYCLES = 1248;
+const double DSP_CYCLE_RATE = 60e6/2;
+// 60 MHz / 2 / 1248, see doc/qsound.cpp
+const double QSOUND_RATE = DSP_CYCLE_RATE/SAMPLE_CYCLES;
+
+// PCM data of a CPS 1.5 ROM. The file is mapped read-only, so jobs
+// playing the same game share the page cache
+class QSndData {
+    int get_offset( const char *header, int p );
+    int mask, len;
+    const char *data;
+    void *map;
+    size_t map_len;
+public:
+    QSndData( const char *rompath );
+    int get( int addr );
+    ~QSndData();
+};
+
+// Sample ROM address. The low seven bits of the external address select
+// the bank, as in MAME, and the PDX output has the address inside it
+inline int qsnd_bank( int ab ) { return ab&0x7f; }
+
+inline int qsnd_rom_addr( int ab, int pdx ) {
+    return (qsnd_bank(ab)<<16) | (pdx&0xffff);
+}
+
+// QSound board as seen by the firmware. For the external ROM, pt selects
+// the bank and the last PDX output has the address inside it. Commands
+// from the main CPU come through the parallel port: irq goes up with the
+// register address on the bus, the data replaces it after the first pdx
+// read and irq goes down, as in the RTL playback
+class QSndIO : public DSP16io {
+    QSndData& samples;
+    DSP16emu& emu;
+    int bus, data, reads;
+public:
+    // external ROM reads are added here as address and value when set
+    std::vector<std::pair<int,int>>* rom_log;
+    QSndIO( QSndData& _samples, DSP16emu& _emu ) : samples(_samples), emu(_emu),
+        bus(0), data(0), reads(0), rom_log(nullptr) {}
+    int ext_read( int addr ) override {
+        int a = qsnd_rom_addr( addr, emu.pbus_out );
+        int v = samples.get( a );
+        if( rom_log ) rom_log->emplace_back( a, v );
+        return v<<8;
+    }
+    int pdx_in( int /*psel*/ ) override {
+        int v = bus;
+        if( ++reads==1 ) {
+            bus = data;
+            emu.set_irq(0);
+        }
+        return v;
+    }
+    void send( int cmd ) {
+        bus   = (cmd>>16)&0xff;
+        data  = cmd&0xffff;
+        reads = 0;
+        emu.set_irq(1);
+    }
+    // the previous command is not processed yet
+    bool busy() const { return emu.irq || emu.iack; }
+    void save( SnapWriter& w ) const { w.put( bus ); w.put( data ); w.put( reads ); }
+    void load( SnapReader& r ) {
+        int b, d, k;
+        r.get( b ); r.get( d ); r.get( k );
+        bus = b; data = d; reads = k;
+    }
+};
+
+QSndData::QSndData( const char *rompath ) {
+    int fd = open( rompath, O_RDONLY );
+    if( fd<0 ) {
+        std::stringstream ss;
+        ss << "Cannot open ROM file " << rompath;
+        throw std::runtime_error(ss.str());
+    }
+    struct stat st;
+    if( fstat( fd, &st )!=0 || st.st_size<64 ) {
+        close(fd);
+        throw std::runtime_error("Cannot read ROM header");
+    }
+    map_len = st.st_size;
+    map = mmap( nullptr, map_len, PROT_READ, MAP_SHARED, fd, 0 );
+    close(fd);
+    if( map==MAP_FAILED ) throw std::runtime_error("Cannot map the ROM file");
+    // Get the header
+    const char *header = (const char*)map;
+    int start = get_offset( header, 2 );
+    int end   = get_offset( header, 4 );
+    len = end-start;
+    if( len<=0 || (size_t)end+64 > map_len ) {
+        char s[256];
+        sprintf(s,"PCM data (%X-%X) is outside the ROM file (0x%lX bytes)", start, end, map_len-64 );
+        munmap( map, map_len );
+        throw std::runtime_error(s);
+    }
+    madvise( map, map_len, MADV_RANDOM );
+    data = header+64+start;
+    for( mask=1; mask<len; mask<<=1 );
+    mask--;
+    std::cout << "Mapping " << rompath << '\n';
+    printf("PCM data start %10X\nPCM data end   %10X. Mask=%0x\n", start, end, mask );
+    printf("Mapped %d (%d MB) as PCM data\n", len, len>>20 );
+}
+
+QSndData::~QSndData() {
+    munmap( map, map_len );
+    map = nullptr;
+    data = nullptr;
+}
+
+// When the PCM size is not a power of two, the addresses past its end read as zero
+int QSndData::get( int addr ) {
+    addr &= mask;
+    return addr<len ? data[addr]&0xff : 0;
+}
+
+int QSndData::get_offset( const char *header, int p ) {
+    int o = ((((int)header[p+1])&0xff)<<8) | (((int)header[p])&0xff);
+    // printf("%X%X->%X\n", (unsigned)header[p+1]&0xff, (unsigned)header[p]&0xff, o);
+    o <<= 10;
+    return o;
+}
+#endif
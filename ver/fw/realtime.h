@@ -0,0 +1,169 @@
+#ifndef __REALTIME_H
+#define __REALTIME_H
+
+#include "args.h"
+#include "emuplay.h"
+#include "WaveWritter.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+// Real-time playback with the emulator. The emulator thread makes the
+// samples as fast as it can and puts them in a ring buffer. A sink thread
+// takes one sample out of it every 1/QSOUND_RATE seconds, like the DAC
+// would. The latency is bounded by the ring size, and the sink counts an
+// under-run each time the emulator falls behind
+
+// Lock-free ring for one producer and one consumer thread.
+// The size is rounded up to a power of two
+template<class T> class SPSCRing {
+    std::vector<T> buf;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;   // next write, only moved by the producer
+    alignas(64) std::atomic<size_t> tail;   // next read, only moved by the consumer
+public:
+    SPSCRing( size_t min_size ) : head(0), tail(0) {
+        size_t n;
+        for( n=2; n<min_size; n<<=1 );
+        buf.resize( n );
+        mask = n-1;
+    }
+    bool push( const T& v ) {
+        size_t h = head.load( std::memory_order_relaxed );
+        if( h-tail.load( std::memory_order_acquire ) > mask ) return false;
+        buf[h&mask] = v;
+        head.store( h+1, std::memory_order_release );
+        return true;
+    }
+    bool pop( T& v ) {
+        size_t t = tail.load( std::memory_order_relaxed );
+        if( t==head.load( std::memory_order_acquire ) ) return false;
+        v = buf[t&mask];
+        tail.store( t+1, std::memory_order_release );
+        return true;
+    }
+    size_t fill() const {
+        return head.load( std::memory_order_acquire )-tail.load( std::memory_order_acquire );
+    }
+    size_t capacity() const { return mask+1; }
+};
+
+struct StereoFrame { int16_t lr[2]; };
+
+struct RealtimeStats {
+    std::atomic<int64_t> played{0}, underruns{0};
+    std::atomic<int> min_fill{0x7fff'ffff};
+};
+
+// Consumer side. The audio file or FIFO is opened here, as opening a FIFO
+// blocks until a reader connects. Playback starts once the ring holds
+// prefill samples
+class RealtimeSink {
+    SPSCRing<StereoFrame>& ring;
+    RealtimeStats& stats;
+    const ParseArgs& args;
+    int prefill;
+    std::atomic<bool> done;
+    std::thread th;
+    void run();
+public:
+    RealtimeSink( SPSCRing<StereoFrame>& _ring, RealtimeStats& _stats, const ParseArgs& _args, int _prefill ) :
+        ring(_ring), stats(_stats), args(_args), prefill(_prefill), done(false) {
+        th = std::thread( &RealtimeSink::run, this );
+    }
+    // plays what is left in the ring and closes the output
+    void finish() {
+        done = true;
+        th.join();
+    }
+};
+
+void RealtimeSink::run() {
+    std::unique_ptr<WaveWritter> wav;
+    if( args.rt_sink==RT_SINK_FIFO ) {
+        if( mkfifo( args.wav_file.c_str(), 0644 )!=0 && errno!=EEXIST )
+            fprintf(stderr,"Cannot make the FIFO %s\n", args.wav_file.c_str() );
+        signal( SIGPIPE, SIG_IGN ); // a reader going away must not end the simulation
+        fprintf(stderr,"Waiting for a reader on %s\n", args.wav_file.c_str() );
+        wav.reset( new WaveWritter( args.wav_file, QSOUND_RATE, false, AUDIO_RAW, 1 ) );
+    } else if( args.rt_sink==RT_SINK_FILE ) {
+        wav.reset( new WaveWritter( args.wav_file, QSOUND_RATE, false, args.audio_format,
+            args.flush_samples ) );
+    }
+    while( !done && ring.fill()<(size_t)prefill )
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>( 1.0/QSOUND_RATE ) );
+    auto deadline = clock::now();
+    StereoFrame f{{0,0}};
+    while( true ) {
+        int fill = ring.fill();
+        // the ring drains after finish(), which is not an underrun risk
+        if( !done && fill < stats.min_fill ) stats.min_fill = fill;
+        if( !ring.pop( f ) ) {
+            if( done ) break;
+            stats.underruns++; // the last sample is held, as a DAC would do
+        }
+        if( wav ) wav->write( f.lr );
+        stats.played++;
+        deadline += period;
+        std::this_thread::sleep_until( deadline );
+    }
+}
+
+int play_realtime( const ParseArgs& args, int16_t* rom ) {
+    QSndData samples( args.qsnd_rom.c_str() );
+    QSCmd cmd( args.playfile );
+    auto cmdlist = cmd.cmdlist();
+    QSndPlayer player( rom, samples, cmdlist, emu_engine( args ), args.verbose );
+
+    const int prefill = std::max( 1, (int)(args.latency*QSOUND_RATE/1000) );
+    SPSCRing<StereoFrame> ring( 2*prefill );
+    RealtimeStats stats;
+
+    // The emulation speed is measured without the time spent waiting
+    // for room in the ring. The worst block of one second of audio is
+    // reported too, as it tells how close the emulator got to falling behind
+    using clock = std::chrono::steady_clock;
+    const int block = (int)QSOUND_RATE;
+    double busy=0, block_busy=0, worst=0;
+    auto t0 = clock::now();
+    RealtimeSink sink( ring, stats, args, prefill );
+    StereoFrame f;
+    int64_t total=0;
+    // the play length is set as in play_emu
+    while( !player.cmd_done() || player.ms()<args.min_sim_time ) {
+        player.next_frame( f.lr );
+        auto t1 = clock::now();
+        block_busy += std::chrono::duration<double>(t1-t0).count();
+        while( !ring.push( f ) )
+            std::this_thread::sleep_for( std::chrono::microseconds(100) );
+        t0 = clock::now();
+        if( ++total%block==0 ) {
+            worst = std::max( worst, block_busy );
+            busy += block_busy;
+            block_busy = 0;
+        }
+    }
+    busy += block_busy;
+    worst = std::max( worst, block_busy*block/std::max( (int64_t)1, total%block ) );
+    sink.finish();
+
+    double audio = total/QSOUND_RATE;
+    fprintf(stderr,"Real-time playback: %ld samples (%.1f s), ring of %d samples (%.1f ms)\n",
+        (long)stats.played, audio, (int)ring.capacity(), ring.capacity()*1000/QSOUND_RATE );
+    fprintf(stderr,"Emulation speed %.2fx real time, %.2fx in the slowest second\n",
+        busy>0 ? audio/busy : 0, worst>0 ? 1.0/worst : 0 );
+    fprintf(stderr,"Under-runs %ld, lowest ring fill %d samples\n",
+        (long)stats.underruns, (int)stats.min_fill );
+    return stats.underruns ? 1 : 0;
+}
+
+#endif
@@ -1,24 +1,55 @@
 #include "common.h"
 #include <fstream>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 
 using namespace std;
 
+// Signals kept in the history ring buffer: name, bit width
+#define HISTORY_SIGNALS \
+    S(pc,16) S(pt,16) S(pr,16) S(pi,16) S(i,12) \
+    S(r0,16) S(r1,16) S(r2,16) S(r3,16) S(rb,16) S(re,16) S(j,16) S(k,16) \
+    S(psw,16) S(auc,7) S(x,16) S(y,16) S(yl,16) S(c0,8) S(c1,8) S(c2,8) \
+    S(p,32) S(a0,36) S(a1,36) \
+    S(srta,8) S(sioc,10) S(sadd,1) S(ser_out,1) \
+    S(psel,1) S(pids,1) S(pods,1) S(pbus_out,16) S(ab,16) S(iack,1)
+
+#define S(n,w) +1
+const int HISTORY_WIDTH = 0 HISTORY_SIGNALS;
+#undef S
+
 RTL::RTL( const char *vcd_name) {
-    Verilated::traceEverOn(true);
-    vcd_dump = true;
-    top.trace(&vcd, 99);
-    vcd.open(vcd_name);
+#if VM_TRACE
+    vcd_dump = vcd_name!=nullptr;
+    if( vcd_dump ) {
+        Verilated::traceEverOn(true);
+        top.trace(&vcd, 99);
+        vcd.open(vcd_name);
+    }
+#else
+    vcd_dump = false;
+#endif
     ticks=0;
     sim_time=0;
     half_period=9;
+    hist_len=hist_pos=hist_cnt=0;
+    fault_seen=false;
+#ifdef JTDSP16_BACKDOOR
+    backdoor=true;
+#else
+    backdoor=false;
+#endif
 
     reset();
 }
 
 bool RTL::fault() {
     int f = top.fault;
+    if( f && !fault_seen ) {
+        fault_seen = true;
+        flush_history();
+    }
     return f!=0;
 }
 
@@ -45,17 +76,32 @@ void RTL::clk(int n) {
         sim_time += half_period;
         top.clk = 0;
         top.eval();
+#if VM_TRACE
         if(vcd_dump) vcd.dump(sim_time);
+#endif
 
         sim_time += half_period;
         top.clk = 1;
         top.eval();
+#if VM_TRACE
         if(vcd_dump) vcd.dump(sim_time);
+#endif
         ticks++;
+        if( hist_len ) capture();
     }
 };
 
 void RTL::read_rom( int16_t* data ) {
+#ifdef JTDSP16_BACKDOOR
+    if( backdoor ) {
+        for( int j=0; j<4*1024; j++ ) {
+            top.jtdsp16__DOT__u_rom__DOT__u_lsb__DOT__mem[j] = data[j]&0xff;
+            top.jtdsp16__DOT__u_rom__DOT__u_msb__DOT__mem[j] = (data[j]>>8)&0xff;
+        }
+        reset(); // refreshes the memory outputs
+        return;
+    }
+#endif
     int addr = 0;
     top.prog_we = 1;
     top.rst = 1;
@@ -75,6 +121,13 @@ void RTL::read_rom( int16_t* data ) {
 }
 
 void RTL::program_ram( int16_t* data ) {
+#ifdef JTDSP16_BACKDOOR
+    if( backdoor ) {
+        memcpy( top.jtdsp16__DOT__u_ram__DOT__ram, data, 2*1024*sizeof(int16_t) );
+        reset();
+        return;
+    }
+#endif
     int addr = 0;
     top.debug_ram_we = 1;
     top.rst = 1;
@@ -87,6 +140,76 @@ void RTL::program_ram( int16_t* data ) {
     reset();
 }
 
+// All the RTL registers go back to their reset values, except the clock
+// divider toggle in jtdsp16_div, which has no reset. Tests always run an
+// even number of clocks, so it is in the same phase as in a new model.
+// The VCD file, if any, goes on with the new test
+void RTL::reinit( int16_t* rom, int16_t* ram ) {
+    ticks=0;
+    hist_pos=hist_cnt=0;
+    fault_seen=false;
+    read_rom( rom );
+    program_ram( ram );
+}
+
+void RTL::keep_history( int cycles, const char *fname ) {
+    hist_len  = cycles>0 ? cycles : 0;
+    hist_pos  = hist_cnt = 0;
+    hist_file = fname;
+    hist.resize( hist_len*HISTORY_WIDTH );
+    hist_time.resize( hist_len );
+}
+
+void RTL::capture() {
+    int64_t *v = &hist[ hist_pos*HISTORY_WIDTH ];
+#define S(n,w) *v++ = n();
+    HISTORY_SIGNALS
+#undef S
+    hist_time[hist_pos] = sim_time;
+    if( ++hist_pos == hist_len ) hist_pos=0;
+    if( hist_cnt < hist_len ) hist_cnt++;
+}
+
+// Writes the buffered cycles, oldest first. Only value changes are dumped
+void RTL::flush_history() {
+    if( hist_cnt==0 ) return;
+    ofstream fout(hist_file);
+    if( !fout.good() ) {
+        cout << "ERROR: cannot write " << hist_file << '\n';
+        return;
+    }
+    const int widths[] = {
+#define S(n,w) w,
+        HISTORY_SIGNALS
+#undef S
+    };
+    int id=0;
+    fout << "$timescale 1ns $end\n$scope module jtdsp16 $end\n";
+#define S(n,w) fout << "$var wire " << w << ' ' << (char)('!'+id++) << ' ' << #n << " $end\n";
+    HISTORY_SIGNALS
+#undef S
+    fout << "$upscope $end\n$enddefinitions $end\n";
+    int first = hist_cnt<hist_len ? 0 : hist_pos;
+    const int64_t *last = nullptr;
+    for( int c=0; c<hist_cnt; c++ ) {
+        int k = (first+c)%hist_len;
+        const int64_t *v = &hist[ k*HISTORY_WIDTH ];
+        fout << '#' << hist_time[k] << '\n';
+        // the first cycle has every value, in the $dumpvars section
+        if( !last ) fout << "$dumpvars\n";
+        for( int s=0; s<HISTORY_WIDTH; s++ ) {
+            if( last && last[s]==v[s] ) continue;
+            fout << 'b';
+            for( int b=widths[s]-1; b>=0; b-- )
+                fout << (char)('0'+((v[s]>>b)&1));
+            fout << ' ' << (char)('!'+s) << '\n';
+        }
+        if( !last ) fout << "$end\n";
+        last = v;
+    }
+    cout << "Last " << hist_cnt << " cycles written to " << hist_file << '\n';
+}
+
 void RTL::dump_ram() {
     ofstream fout("ram.bin",ios_base::binary);
     fout.write( (char*)top.jtdsp16__DOT__u_ram__DOT__ram, 2048*2 );
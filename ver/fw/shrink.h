@@ -0,0 +1,214 @@
+#ifndef __SHRINK_H
+#define __SHRINK_H
+
+#include "common.h"
+#include "DSP16emu.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Shrinks a failing random test, using the dual run as the oracle: a
+// candidate is kept if the emulator and the RTL still fail in the same
+// way. The ROM past the last instruction run is cleared first. Then
+// blocks of instructions are replaced by NOPs, blocks of RAM are set to
+// zero and blocks of instructions are deleted, halving the block size
+// down to one word. Register loads are instructions too, so the NOP pass
+// drops the ones that do not matter. Candidates are run -jobs at a time,
+// and the first failing one in address order is kept, so the result does
+// not depend on the number of jobs
+
+const int16_t SHRINK_NOP = 0x30C0; // F1 nop with Y=*r0, which changes nothing
+
+struct ShrinkTest {
+    std::vector<int16_t> rom, ram;
+    int ops;        // instructions run up to the failure
+    bool fault;     // the RTL fault signal went up, instead of a divergence
+};
+
+class Shrinker {
+    const ParseArgs& args;
+    int jobs, runs;
+    bool fails( ShrinkTest& t );
+    int  last_pc( const ShrinkTest& t );
+    void reduce( std::vector<int16_t> ShrinkTest::*mem, int len, int16_t fill, bool del=false );
+    void report( const char *step );
+public:
+    ShrinkTest best;
+    Shrinker( const ParseArgs& _args, int _jobs ) : args(_args), jobs(_jobs), runs(0) {}
+    bool run();
+    void write_asm( const std::string& fname, int seed );
+};
+
+// Runs the dual test up to the previous failure. t.ops is updated, as a
+// smaller test may fail earlier
+bool Shrinker::fails( ShrinkTest& t ) {
+    DualRun r = dual_run( args, t.rom.data(), t.ram.data(), t.ops, REPORT_NONE, 0 );
+    if( !r.failed() || r.fault!=t.fault ) return false;
+    t.ops = r.ops+1;
+    return true;
+}
+
+// Last ROM address read by the emulator, including long immediate data
+int Shrinker::last_pc( const ShrinkTest& t ) {
+    std::vector<int16_t> rom( t.rom );
+    DSP16emu emu( rom.data() );
+    memcpy( emu.get_ram(), t.ram.data(), 2048*sizeof(int16_t) );
+    int hi=0;
+    for( int k=0; k<t.ops; k++ ) {
+        hi = std::max( hi, emu.pc );
+        emu.eval();
+    }
+    return std::min( std::max( hi, emu.pc-1 ), 4*1024-1 );
+}
+
+// Fills blocks of mem with fill, or deletes them if del is set. The
+// words after a deleted block move down and the end is filled
+void Shrinker::reduce( std::vector<int16_t> ShrinkTest::*mem, int len, int16_t fill, bool del ) {
+    for( int chunk=std::max( 1, len/2 ); ; chunk/=2 ) {
+        int pos=0;
+        while( pos<len ) {
+            // the next blocks, one per job. Blocks already filled are skipped
+            std::vector<int> starts;
+            for( ; pos<len && (int)starts.size()<jobs; pos+=chunk ) {
+                const std::vector<int16_t>& m = best.*mem;
+                int end = std::min( pos+chunk, len );
+                if( del || std::any_of( m.begin()+pos, m.begin()+end, [fill](int16_t v) { return v!=fill; } ) )
+                    starts.push_back( pos );
+            }
+            if( starts.empty() ) break;
+            std::vector<ShrinkTest> cand( starts.size(), best );
+            std::vector<char> bad( starts.size(), 0 );
+            for( size_t k=0; k<cand.size(); k++ ) {
+                std::vector<int16_t>& m = cand[k].*mem;
+                int end = std::min( starts[k]+chunk, len );
+                if( del ) {
+                    m.erase( m.begin()+starts[k], m.begin()+end );
+                    m.insert( m.end(), end-starts[k], fill );
+                } else {
+                    std::fill( m.begin()+starts[k], m.begin()+end, fill );
+                }
+            }
+            std::atomic<int> next(0);
+            auto worker = [&]() {
+                int k;
+                while( (k=next++) < (int)cand.size() ) bad[k] = fails( cand[k] );
+            };
+            std::vector<std::thread> pool;
+            for( int k=0; k<std::min( jobs, (int)cand.size() ); k++ ) pool.emplace_back( worker );
+            for( auto& t : pool ) t.join();
+            runs += cand.size();
+            auto first = std::find( bad.begin(), bad.end(), 1 );
+            if( first != bad.end() ) {
+                // later candidates were made from the old test
+                int k = first-bad.begin();
+                best = cand[k];
+                if( del ) {
+                    len -= std::min( starts[k]+chunk, len )-starts[k];
+                    pos  = starts[k];
+                } else {
+                    pos  = starts[k]+chunk;
+                }
+            }
+        }
+        if( chunk==1 ) break;
+    }
+}
+
+void Shrinker::report( const char *step ) {
+    int last = last_pc( best );
+    int ops  = std::count_if( best.rom.begin(), best.rom.begin()+last+1,
+        [](int16_t v) { return v!=SHRINK_NOP; } );
+    int ram  = std::count_if( best.ram.begin(), best.ram.end(), [](int16_t v) { return v!=0; } );
+    printf("%-10s %4d ROM words, %4d not NOP, %4d RAM words not zero, fails after %d instructions (%d runs)\n",
+        step, last+1, ops, ram, best.ops, runs );
+}
+
+bool Shrinker::run() {
+    best.ops = std::min( args.max, 3200 );
+    best.fault = false;
+    DualRun r = dual_run( args, best.rom.data(), best.ram.data(), best.ops, REPORT_NONE, 0 );
+    runs++;
+    if( !r.failed() ) return false;
+    best.fault = r.fault;
+    best.ops   = r.ops+1;
+    report("start");
+
+    ShrinkTest cut = best;
+    std::fill( cut.rom.begin()+last_pc( best )+1, cut.rom.end(), SHRINK_NOP );
+    runs++;
+    if( fails( cut ) ) best = cut;
+    report("truncate");
+
+    reduce( &ShrinkTest::rom, last_pc( best )+1, SHRINK_NOP );
+    report("ROM");
+    reduce( &ShrinkTest::ram, 2048, 0 );
+    report("RAM");
+    // NOPs may now clear instructions that only mattered for the RAM values
+    reduce( &ShrinkTest::rom, last_pc( best )+1, SHRINK_NOP );
+    report("ROM");
+    reduce( &ShrinkTest::rom, last_pc( best )+1, SHRINK_NOP, true );
+    report("delete");
+    return true;
+}
+
+// Writes the ROM as raw words for dsp16as, ending in a loop as the tests
+// in ver/top do. The RTL tests there cannot set the RAM, so the words that
+// must be set are listed in the header. The image for -image is saved
+// next to it
+void Shrinker::write_asm( const std::string& fname, int seed ) {
+    int last = last_pc( best );
+    // check that the final loop does not hide the failure
+    ShrinkTest t = best;
+    // a test that reaches the last ROM word has no room for the loop
+    bool loop = last<4*1024-1;
+    std::fill( t.rom.begin()+last+1, t.rom.end(), SHRINK_NOP );
+    if( loop ) t.rom[last+1] = last+1; // goto end
+    bool kept = fails( t );
+
+    std::ofstream fout( fname );
+    fout << "# Shrunk from seed " << seed << ". The emulator and the RTL ";
+    fout << ( best.fault ? "assert fault" : "diverge" ) << " after " << best.ops << " instructions\n";
+    if( !kept ) fout << "# The failure does not show with the final goto loop\n";
+    int ram = std::count_if( best.ram.begin(), best.ram.end(), [](int16_t v) { return v!=0; } );
+    if( ram ) fout << "# RAM words that are not zero (address: value):\n";
+    char buf[128];
+    for( int k=0; k<2048; k++ ) {
+        if( best.ram[k]==0 ) continue;
+        snprintf( buf, sizeof(buf), "#   0x%03X: 0x%04X\n", k, best.ram[k]&0xffff );
+        fout << buf;
+    }
+    for( int k=0; k<=last; k++ ) {
+        int op = best.rom[k]&0xffff;
+        snprintf( buf, sizeof(buf), "dw 0x%04X    # %03X %s\n", op, k,
+            op==(SHRINK_NOP&0xffff) ? "nop" : DSP16emu::disasm_text(op).c_str() );
+        fout << buf;
+    }
+    if( loop ) fout << "end:\ngoto end\n";
+    if( !fout.good() ) throw std::runtime_error("Cannot write "+fname);
+
+    std::string image = fname.substr( 0, fname.rfind('.') )+".bin";
+    save_image( image, best.rom.data(), best.ram.data() );
+    printf("Shrunk test written to %s and %s%s\n", fname.c_str(), image.c_str(),
+        kept ? "" : ". It does not fail with the final goto loop" );
+}
+
+int shrink( const ParseArgs& args ) {
+    int jobs = args.jobs>0 ? args.jobs : std::max( 1u, std::thread::hardware_concurrency() );
+    Shrinker sh( args, jobs );
+    sh.best.rom.resize( 4*1024 );
+    sh.best.ram.resize( 2048 );
+    if( make_test( args, args.seed, sh.best.rom.data(), sh.best.ram.data() ) ) return 1;
+    if( !sh.run() ) {
+        printf("The test passes, there is nothing to shrink\n");
+        return 1;
+    }
+    sh.write_asm( args.shrink_file, args.seed );
+    return 0;
+}
+
+#endif
@@ -1,19 +1,60 @@
 #!/bin/bash
 
+# -emu builds and runs the emulator-only player, which needs neither
+# Verilator nor the C model
+if [ "$1" = -emu ]; then
+    shift
+    g++ -O2 -std=c++17 -pthread emuplay.cc args.cc qscmd.cc vcd.cc WaveWritter.cc \
+        -o emuplay || exit $?
+    ./emuplay $*
+    exit $?
+fi
+
 if [ ! -e $JTUTIL/model/dsp16/dsp16_model.h ]; then
     echo "You need model/dsp16/dsp16_model.h from the jtutil repository"
     exit 1
 fi
 
+# -fast builds a multithreaded model without VCD support in obj_fast
+# for long playback runs. THREADS sets the number of model threads
+if [ "$1" = -fast ]; then
+    shift
+    THREADS=${THREADS:-4}
+    verilator ../../hdl/*.v --cc --top-module jtdsp16 --exe \
+        test.cc args.cc vcd.cc rtl.cc mametrace.cc WaveWritter.cc qscmd.cc \
+        $JTUTIL/model/dsp16/dsp16_model.c \
+        --Mdir obj_fast --threads $THREADS -O3 --x-assign fast --x-initial fast \
+        -DJTDSP16_DEBUG || exit $?
+    export CPPFLAGS="$CPPFLAGS -O3 -I$JTUTIL/model/dsp16 -DJTDSP16_BACKDOOR"
+    make -j -C obj_fast -f Vjtdsp16.mk Vjtdsp16 || exit $?
+    obj_fast/Vjtdsp16 $*
+    exit $?
+fi
+
+# -fuzz N runs N random tests on all cores. The model is built without
+# VCD support in obj_fuzz. Each test thread has its own model instance, so
+# the model itself is single threaded
+if [ "$1" = -fuzz ]; then
+    verilator ../../hdl/*.v --cc --top-module jtdsp16 --exe \
+        test.cc args.cc vcd.cc rtl.cc mametrace.cc WaveWritter.cc qscmd.cc \
+        $JTUTIL/model/dsp16/dsp16_model.c \
+        --Mdir obj_fuzz --threads 1 -O3 --x-assign fast --x-initial fast \
+        -DJTDSP16_DEBUG -LDFLAGS -pthread || exit $?
+    export CPPFLAGS="$CPPFLAGS -O3 -I$JTUTIL/model/dsp16 -DJTDSP16_BACKDOOR"
+    make -j -C obj_fuzz -f Vjtdsp16.mk Vjtdsp16 || exit $?
+    obj_fuzz/Vjtdsp16 $*
+    exit $?
+fi
+
 verilator ../../hdl/*.v --cc --top-module jtdsp16 --exe \
-    test.cc vcd.cc rtl.cc mametrace.cc WaveWritter.cc \
+    test.cc args.cc vcd.cc rtl.cc mametrace.cc WaveWritter.cc qscmd.cc \
     $JTUTIL/model/dsp16/dsp16_model.c \
-    --trace -DJTDSP16_DEBUG -DJTDSP16_DUMP || exit $?
-export CPPFLAGS="$CPPFLAGS -O3 -I$JTUTIL/model/dsp16"
+    --trace -DJTDSP16_DEBUG -DJTDSP16_DUMP -LDFLAGS -pthread || exit $?
+export CPPFLAGS="$CPPFLAGS -O3 -I$JTUTIL/model/dsp16 -DJTDSP16_BACKDOOR"
 make -j -C obj_dir -f Vjtdsp16.mk Vjtdsp16 || exit $?
 
 if which vcd2fst; then
     sim $* -vcd >(vcd2fst -v - -f test.fst)
 else
     sim $* -vcd test.vcd
-fi
\ No newline at end of file
+fi
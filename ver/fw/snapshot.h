@@ -0,0 +1,53 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Binary snapshots. Each one starts with an 8-character magic string
+// and a version number. Values are stored in host byte order
+
+class SnapWriter {
+    std::ostream& os;
+public:
+    SnapWriter( std::ostream& _os, const char *magic, uint32_t version ) : os(_os) {
+        os.write( magic, 8 );
+        put( version );
+    }
+    template<class T> void put( const T& v ) {
+        os.write( (const char*)&v, sizeof(T) );
+    }
+    void put_array( const void *buf, int len ) {
+        os.write( (const char*)buf, len );
+    }
+    bool good() { return os.good(); }
+};
+
+class SnapReader {
+    std::istream& is;
+public:
+    SnapReader( std::istream& _is, const char *magic, uint32_t version ) : is(_is) {
+        char m[8];
+        uint32_t v;
+        is.read( m, 8 );
+        if( !is.good() || memcmp( m, magic, 8 )!=0 )
+            throw std::runtime_error(std::string("Not a ")+std::string(magic,8)+" snapshot");
+        get( v );
+        if( v!=version )
+            throw std::runtime_error(std::string("Unsupported ")+std::string(magic,8)
+                +" snapshot version "+std::to_string(v));
+    }
+    template<class T> void get( T& v ) {
+        is.read( (char*)&v, sizeof(T) );
+        if( !is.good() ) throw std::runtime_error("Truncated snapshot");
+    }
+    void get_array( void *buf, int len ) {
+        is.read( (char*)buf, len );
+        if( !is.good() ) throw std::runtime_error("Truncated snapshot");
+    }
+};
+
+#endif
@@ -2,13 +2,26 @@
 
 #include "common.h"
 #include "DSP16emu.h"
+#include "DSP16batch.h"
 #include "playfiles.h"
+#include "partrace.h"
+#include "emuplay.h"
+#include "realtime.h"
+#include "shrink.h"
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <cstdio>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -41,17 +54,44 @@ const int IF_CON_F2  = 1<<19;
 // Z operations
 const int Zy_F1      = 1<<21;
 
+// Coverage of a random test. guide has the cells covered by earlier tests
+// and biases the random ROM. cov collects the cells reached by this one
+struct TestCoverage {
+    const DSP16cov *guide=nullptr;
+    DSP16cov *cov=nullptr;
+};
+
+// Instructions drawn for each ROM word when the ROM is guided by coverage
+const int COV_CANDIDATES = 8;
+
 int random_tests( ParseArgs& args );
+int random_test( const ParseArgs& args, int seed, bool quiet, TestCoverage tc={} );
+int fuzz( const ParseArgs& args );
+int batch_test( const ParseArgs& args );
+
+// Random numbers for the test ROM and RAM. Each thread has its own state,
+// so a seed gives the same test in the fuzzer and in a single run
+thread_local unsigned rnd_state;
+int rnd() { return rand_r( &rnd_state ); }
 
 int main( int argc, char *argv[] ) {
-    ParseArgs args( argc, argv );
-    if( args.error ) return 1;
-    if( args.exit ) return 0;
     try {
-        if( args.playback )
+        ParseArgs args( argc, argv );
+        if( args.error ) return 1;
+        if( args.exit ) return 0;
+        if( args.playback && (args.realtime || args.emu) ) {
+            ROM rom;
+            return args.realtime ? play_realtime(args, rom.data()) : play_emu(args, rom.data());
+        } else if( args.playback )
             return play_qs(args);
         else if( args.tracecmp )
-            return cmptrace(args);
+            return args.emu ? cmptrace_emu(args) : cmptrace(args);
+        else if( args.batch )
+            return batch_test(args);
+        else if( args.fuzz )
+            return fuzz(args);
+        else if( !args.shrink_file.empty() )
+            return shrink(args);
         else
             return random_tests(args);
     } catch( runtime_error e ) {
@@ -62,9 +102,19 @@ int main( int argc, char *argv[] ) {
 }
 
 int random_tests( ParseArgs& args ) {
-    RTL rtl( args.vcd_file.c_str());
-    ROM rom;
-    if( rom.random( // GOTOJA |
+    return random_test( args, args.seed, false );
+}
+
+// Makes the ROM and the initial RAM of a random test from the seed, or
+// reads them from -image if it is set
+int make_test( const ParseArgs& args, int seed, int16_t* rom, int16_t* ram, const DSP16cov* guide ) {
+    if( !args.image_file.empty() ) {
+        load_image( args.image_file, rom, ram );
+        return 0;
+    }
+    rnd_state = seed;
+    ROM r( false );
+    if( r.random( // GOTOJA |
         SHORTIMM |
         LONGIMM |
         //DO_REDO |
@@ -87,55 +137,237 @@ int random_tests( ParseArgs& args ) {
         Zy_F1     |
         // F2
         IF_CON_F2 |
-        0
+        0,
+        guide
      ) ) return 1;
-    rtl.read_rom( rom.data() );
-    DSP16emu emu( rom.data() );
-    emu.randomize_ram();
-    emu.verbose = args.verbose;
-    rtl.program_ram( emu.get_ram() );
+    memcpy( rom, r.data(), 4*1024*sizeof(int16_t) );
+    for( int k=0; k<2048; k++ ) ram[k] = rnd();
+    return 0;
+}
+
+// Models kept by each thread for the runs without REPORT_FULL. A fuzz or
+// shrink worker reloads them for every test instead of making new ones
+thread_local unique_ptr<RTL> reused_rtl;
+thread_local unique_ptr<DSP16emu> reused_emu;
+
+// Runs the emulator and the RTL side by side for up to max_ops instructions.
+// REPORT_FULL adds the VCD file and the register dumps to the result line
+DualRun dual_run( const ParseArgs& args, int16_t* rom, const int16_t* ram, int max_ops,
+        DualReport report, int seed, DSP16cov* cov ) {
+    bool full = report==REPORT_FULL;
+    // REPORT_FULL writes its own VCD file, so it gets new models
+    unique_ptr<RTL> full_rtl;
+    unique_ptr<DSP16emu> full_emu;
+    unique_ptr<RTL>& rtl_ptr = full ? full_rtl : reused_rtl;
+    unique_ptr<DSP16emu>& emu_ptr = full ? full_emu : reused_emu;
+    if( !rtl_ptr ) {
+        rtl_ptr.reset( new RTL( full ? args.vcd_file.c_str() : nullptr ) );
+        rtl_ptr->backdoor &= !args.port_load;
+        emu_ptr.reset( new DSP16emu( rom, args.threaded ? ENGINE_THREADED : ENGINE_SWITCH ) );
+    } else {
+        emu_ptr->reset( rom );
+    }
+    RTL& rtl = *rtl_ptr;
+    DSP16emu& emu = *emu_ptr;
+    memcpy( emu.get_ram(), ram, 2048*sizeof(int16_t) );
+    emu.cov = cov;
+    emu.verbose = args.verbose && full;
+    rtl.reinit( rom, emu.get_ram() );
 
     bool good=true;
+    if( args.history && report!=REPORT_NONE ) {
+        if( full )
+            rtl.keep_history( args.history );
+        else
+            rtl.keep_history( args.history, ("history-"+to_string(seed)+".vcd").c_str() );
+    } else {
+        rtl.keep_history( 0 ); // a reused model may have it from an earlier test
+    }
 
     // Simulate
     int k;
-    for( k=0; k<3200 && !rtl.fault() && k<args.max; k++ ) {
-        int ticks = emu.eval();
+    for( k=0; k<3200 && !rtl.fault() && k<max_ops; k++ ) {
+        int ticks = args.blocks ? emu.eval_block() : emu.eval();
         rtl.clk(ticks<<1);
         good = compare(rtl,emu);
         if( !good ) {
             if(args.extra) rtl.clk(2);
+            rtl.flush_history();
             break;
         }
-        if( args.step ) { dump(rtl, emu); putchar('\n'); }
+        if( args.step && full ) { dump(rtl, emu); putchar('\n'); }
     }
 
     // Close down
-    if( rtl.fault() ) {
-        cout << "ERROR: fault was asserted\n";
-        return 1;
+    DualRun r;
+    r.ops      = k;
+    r.fault    = rtl.fault();
+    r.diverged = !good;
+    if( report==REPORT_NONE ) return r;
+    if( r.fault ) {
+        printf("ERROR: fault was asserted (seed=%d)\n", seed);
+    } else if( r.diverged ) {
+        printf("ERROR: emulator and RTL diverged after %d operations (seed=%d) \n", k, seed);
+        if( full ) dump(rtl, emu);
+    } else if( full ) {
+        if( args.verbose ) dump(rtl, emu);
+        printf("PASSED %d operations\n", k);
     }
-    if( !good ) {
-        printf("ERROR: emulator and RTL diverged after %d operations (seed=%d) \n", k, args.seed);
-        dump(rtl, emu);
-        return 1;
+    return r;
+}
+
+// Runs one random test. Only the result line is printed when quiet is set
+int random_test( const ParseArgs& args, int seed, bool quiet, TestCoverage tc ) {
+    vector<int16_t> rom( 4*1024 ), ram( 2048 );
+    if( make_test( args, seed, rom.data(), ram.data(), tc.guide ) ) return 1;
+    DualRun r = dual_run( args, rom.data(), ram.data(), args.max,
+        quiet ? REPORT_RESULT : REPORT_FULL, seed, tc.cov );
+    // a guided test depends on the coverage at the time, so it cannot
+    // be made again from the seed. Its image is saved if it fails
+    if( r.failed() && tc.guide ) {
+        string fname = "fuzz-"+to_string(seed)+".bin";
+        save_image( fname, rom.data(), ram.data() );
+        printf("Test image saved to %s\n", fname.c_str() );
+    }
+    return r.failed() ? 1 : 0;
+}
+
+// Runs -fuzz seeds from -seed on -jobs threads, each reusing its own RTL
+// model and emulator. New seeds stop being taken after -maxfail failures.
+// A failing seed can be run again on its own to get the VCD and the dump.
+// The instruction coverage of all tests is gathered in one map. With -cov
+// each new ROM is biased towards the cells missing from it. Each thread
+// keeps its own coverage and only merges it, and takes a new guide, every
+// COV_BATCH seeds, so the map is not copied under the lock for each test
+const int COV_BATCH=16;
+
+int fuzz( const ParseArgs& args ) {
+    std::atomic<int> next(0), passed(0), failed(0);
+    std::mutex mtx;
+    std::vector<int> bad_seeds;
+    DSP16cov total;
+    auto worker = [&]() {
+        DSP16cov guide, cov; // cov has all the cells reached by this thread
+        int n, batch=0;
+        while( failed<args.max_fail && (n=next++) < args.fuzz ) {
+            int seed = args.seed+n;
+            if( args.cov && batch==0 ) {
+                std::lock_guard<std::mutex> lock(mtx);
+                total.merge( cov );
+                guide = total;
+            }
+            if( ++batch==COV_BATCH ) batch=0;
+            int bad = random_test( args, seed, true, { args.cov ? &guide : nullptr, &cov } );
+            if( bad ) {
+                std::lock_guard<std::mutex> lock(mtx);
+                failed++;
+                bad_seeds.push_back( seed );
+            } else {
+                passed++;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        total.merge( cov );
+    };
+    int jobs = args.jobs>0 ? args.jobs : std::max( 1u, std::thread::hardware_concurrency() );
+    jobs = std::min( jobs, args.fuzz );
+    std::vector<std::thread> pool;
+    for( int k=0; k<jobs; k++ ) pool.emplace_back( worker );
+    for( auto& t : pool ) t.join();
+
+    std::sort( bad_seeds.begin(), bad_seeds.end() );
+    printf("%d passed, %d failed out of %d seeds (%d jobs)\n",
+        (int)passed, (int)failed, (int)passed+(int)failed, jobs );
+    printf("%d instruction coverage cells reached\n", total.count() );
+    if( bad_seeds.empty() ) return 0;
+    if( failed>=args.max_fail && passed+failed<args.fuzz )
+        printf("Stopped after %d failures\n", (int)failed );
+    printf("Failing seeds:");
+    for( int s : bad_seeds ) printf(" %d", s );
+    putchar('\n');
+    return 1;
+}
+
+// Runs -batch lanes of the test of the seed, or of -image, in DSP16batch
+// and each lane again on its own DSP16emu. Lane k starts with k random
+// RAM words changed, so the lanes split and join again. Every run_until
+// gets random budgets, event masks and breakpoints, and random IRQ
+// changes. The results and the full state of each lane must match
+int batch_test( const ParseArgs& args ) {
+    vector<int16_t> rom( 4*1024 ), ram( 2048 );
+    if( make_test( args, args.seed, rom.data(), ram.data(), nullptr ) ) return 1;
+    DSP16engine engine = emu_engine( args );
+    int n = args.batch;
+    DSP16batch batch( rom.data(), n, engine );
+    vector<unique_ptr<DSP16emu>> ref;
+    for( int k=0; k<n; k++ ) {
+        ref.emplace_back( new DSP16emu( rom.data(), engine ) );
+        for( int w=0; w<k; w++ ) ram[rnd()&0x7ff] = rnd();
+        memcpy( batch[k].get_ram(), ram.data(), 2048*sizeof(int16_t) );
+        memcpy( ref[k]->get_ram(), ram.data(), 2048*sizeof(int16_t) );
+    }
+    vector<EmuRun> runs( n );
+    int calls;
+    for( calls=0; ref[0]->ticks<args.max; calls++ ) {
+        int budget = 1+rnd()%64;
+        int mask = rnd()&0x3f;
+        for( int k=0; k<n; k++ ) {
+            int bp = (rnd()&3)==0 ? rnd()&0xfff : -1;
+            batch[k].breakpoint = ref[k]->breakpoint = bp;
+            if( (rnd()&7)==0 ) {
+                int irq = rnd()&1;
+                batch[k].set_irq( irq );
+                ref[k]->set_irq( irq );
+            }
+        }
+        batch.run_until( budget, mask, runs.data() );
+        for( int k=0; k<n; k++ ) {
+            EmuRun r = ref[k]->run_until( budget, mask );
+            ostringstream got, exp;
+            batch[k].save( got );
+            ref[k]->save( exp );
+            if( r.cycles!=runs[k].cycles || r.events!=runs[k].events || got.str()!=exp.str() ) {
+                printf("ERROR: lane %d differs from DSP16emu in run_until call %d (seed=%d)\n",
+                    k, calls, args.seed );
+                printf("\tcycles %d events %X, expected cycles %d events %X\n",
+                    runs[k].cycles, runs[k].events, r.cycles, r.events );
+                return 1;
+            }
+        }
     }
-    if( args.verbose ) dump(rtl, emu);
-    printf("PASSED %d operations\n", k);
+    printf("PASSED %d run_until calls on %d lanes\n", calls, n );
+    if( batch.steps )
+        printf("%.1f lanes per instruction run in lockstep, %ld instructions\n",
+            (double)batch.lane_steps/batch.steps, (long)batch.lane_steps );
     return 0;
 }
 
-ROM::ROM() {
+void save_image( const string& fname, const int16_t* rom, const int16_t* ram ) {
+    ofstream fout( fname, ios_base::binary );
+    fout.write( (char*)rom, 4*1024*sizeof(int16_t) );
+    fout.write( (char*)ram, 2*1024*sizeof(int16_t) );
+    if( !fout.good() ) throw runtime_error("Cannot write "+fname);
+}
+
+void load_image( const string& fname, int16_t* rom, int16_t* ram ) {
+    ifstream fin( fname, ios_base::binary );
+    fin.read( (char*)rom, 4*1024*sizeof(int16_t) );
+    fin.read( (char*)ram, 2*1024*sizeof(int16_t) );
+    if( !fin.good() ) throw runtime_error("Cannot read the test image "+fname);
+}
+
+ROM::ROM( bool load ) {
+    rom=new int16_t[4*1024]();
+    if( !load ) return;
     ifstream fin("dl-1425.bin",ios_base::binary);
     if( fin.bad() ) {
         throw runtime_error("Cannot find dl-1425.bin");
     }
-    rom=new int16_t[4*1024];
     fin.read( (char*)rom, 8*1024 );
 }
 
 ROM::~ROM() {
-    delete rom;
+    delete[] rom;
     rom = nullptr;
 }
 
@@ -155,90 +387,125 @@ int random_rfield(bool pdx_en=false) {
     while( !(r<=11 || (r>=16 && r<31) )
             || r==PIOC || r==TDMS || r==SDX || ( (r==PDX0 || r==PDX1 ) && !pdx_en )
             || r==PI
-            || r==PSW ) r=rand()%31;
+            || r==PSW ) r=rnd()%31;
     return r;
 }
 
-int ROM::random( int valid ) {
+// Number of AUC modes in which op has not run yet. Writes to AUC get
+// the top score, as they let the next instructions reach new AUC modes
+int uncovered( const DSP16cov& cov, int op ) {
+    int t = (op>>11)&0x1f;
+    if( (t==9 || t==10 || t==11 || t==15) && ((op>>4)&0x3f)==19 ) return 16;
+    int n=0;
+    for( int auc=0; auc<16; auc++ ) n += !cov.covered( op, auc );
+    return n;
+}
+
+int ROM::random( int valid, const DSP16cov* guide ) {
     if(valid==0) valid=~0;
-    // the cache mask avoids illegal instructions for the cache and also
-    // the long immediate instruction because it complicates the random ROM filling
-    // and it is never used inside the cache in the QSound firmware, so I don't test it
-    const int cache_mask = (~( (1<<30) | (1<<10) | (1<<14) | (1<<1) | 1| (1<<16) | (1<<17) | (1<<24) | (1<<26) ))&0xFFFF'FFFF;
     int incache = 0;
     bool cache_ready = false;
 
     for( int k=0; k<4*1024; k++ ) {
-        int r =0;
-        do {
-            r = rand()%32;
-        } while( ((1<<r) & valid) == 0 || (incache && ((1<<r) & cache_mask)==0  ));
-        //printf("%04X - %X\n",r, ((1<<r) & valid));
-        int op;
-        op  = r << 11;
-        // prevents illegal OP codes
-        int extra=0;
-        switch( r ) {
-            case 0:
-            case 2:
-            case 3: extra = rand()%4096; break; // GOTO, Short immediate
-            case 8:  // aT=R
-            case 9:  // R=a0
-            case 11: // R=a1
-                extra  = (rand()%2) << 10;
-                extra |= random_rfield(r!=8) << 4; break; // aT=R
-            case 10: extra = random_rfield(true) << 4; break; // R=imm
-            case 14: // Do / Redo
-                extra = rand()%0x800;
-                while( ((extra>>7)&0xf) == 0 && !cache_ready )
-                    extra |= (rand()%16)<<7; // The first cache use cannot be a Redo
-                while( (extra&0x7f) < 2 )
-                    extra |= rand()%128;
-                incache = ((extra>>7)&0xf);
-                if( incache > 0 ) incache++; // because 1 will be subtracted at the bottom of this for loop
-                break;
-            case 12: /* Y = R */ case 15: // R = Y
-                extra  = random_rfield(false) << 4;
-                extra |= rand()%16; // Y field
-                break;
-            // F1 operations:
-            case 6:
-                extra = rand()%0x800;
-                extra &= ~0x10;
-                break;
-            case 4:  case 7:
-            case 20: case 22: case 23: case 25: case 27:
-            case 28: case 31:
-                extra = rand()%0x800;
-                break;
-            case 21: // Z:y F1
-                extra = rand()%0x800;
-                extra &= ~3;
-                break;
-            case 19: // if CON F2
-                do {
-                    extra = rand()%0x800;
-                } while( ((extra>>5) &0xf)==10 || (extra&0x1f)>17 ); // avoid reserved F2 value
-                    // and avoid wrong CON values
-                break;
-            default:
-                printf("Error: unsupported OP 0x%X (%d) for randomization\n", r, r);
-                for( int j=0; j<k; j++ ) {
-                    printf("%04X ", rom[j]&0xFFFF );
-                    if( (j&7)==7 ) putchar('\n');
+        int op = random_op( valid, incache, cache_ready );
+        // With coverage feedback, a few candidates are drawn and the
+        // one that reaches the most uncovered cells is kept
+        if( guide && op>=0 ) {
+            int best = uncovered( *guide, op );
+            for( int c=1; c<COV_CANDIDATES && best<16; c++ ) {
+                int alt = random_op( valid, incache, cache_ready );
+                int n = alt<0 ? 0 : uncovered( *guide, alt );
+                if( n>best ) {
+                    op   = alt;
+                    best = n;
                 }
-                putchar('\n');
-                return 1;
+            }
+        }
+        if( op<0 ) {
+            for( int j=0; j<k; j++ ) {
+                printf("%04X ", rom[j]&0xFFFF );
+                if( (j&7)==7 ) putchar('\n');
+            }
+            putchar('\n');
+            return 1;
         }
-        extra &= 0x7ff;
-        op |= extra;
         //printf("%04X = %04X\n", k, op );
         rom[k] = op;
+        if( ((op>>11)&0x1f)==14 ) { // Do / Redo
+            incache = (op>>7)&0xf;
+            if( incache > 0 ) incache++; // because 1 will be subtracted at the bottom of this for loop
+        }
         if(incache>0) incache--;
     }
     return 0;
 }
 
+// Draws one instruction of the formats in valid. It returns -1 if one of
+// them cannot be randomized
+int ROM::random_op( int valid, int incache, bool cache_ready ) {
+    // the cache mask avoids illegal instructions for the cache and also
+    // the long immediate instruction because it complicates the random ROM filling
+    // and it is never used inside the cache in the QSound firmware, so I don't test it
+    const int cache_mask = (~( (1<<30) | (1<<10) | (1<<14) | (1<<1) | 1| (1<<16) | (1<<17) | (1<<24) | (1<<26) ))&0xFFFF'FFFF;
+    int r =0;
+    do {
+        r = rnd()%32;
+    } while( ((1<<r) & valid) == 0 || (incache && ((1<<r) & cache_mask)==0  ));
+    //printf("%04X - %X\n",r, ((1<<r) & valid));
+    int op;
+    op  = r << 11;
+    // prevents illegal OP codes
+    int extra=0;
+    switch( r ) {
+        case 0:
+        case 2:
+        case 3: extra = rnd()%4096; break; // GOTO, Short immediate
+        case 8:  // aT=R
+        case 9:  // R=a0
+        case 11: // R=a1
+            extra  = (rnd()%2) << 10;
+            extra |= random_rfield(r!=8) << 4; break; // aT=R
+        case 10: extra = random_rfield(true) << 4; break; // R=imm
+        case 14: // Do / Redo
+            extra = rnd()%0x800;
+            while( ((extra>>7)&0xf) == 0 && !cache_ready )
+                extra |= (rnd()%16)<<7; // The first cache use cannot be a Redo
+            while( (extra&0x7f) < 2 )
+                extra |= rnd()%128;
+            break;
+        case 12: /* Y = R */ case 15: // R = Y
+            extra  = random_rfield(false) << 4;
+            extra |= rnd()%16; // Y field
+            break;
+        // F1 operations:
+        case 6:
+            extra = rnd()%0x800;
+            extra &= ~0x10;
+            break;
+        case 4:  case 7:
+        case 20: case 22: case 23: case 25: case 27:
+        case 28: case 31:
+            extra = rnd()%0x800;
+            break;
+        case 21: // Z:y F1
+            extra = rnd()%0x800;
+            extra &= ~3;
+            break;
+        case 19: // if CON F2
+            do {
+                extra = rnd()%0x800;
+            } while( ((extra>>5) &0xf)==10 || (extra&0x1f)>17 ); // avoid reserved F2 value
+                // and avoid wrong CON values
+            break;
+        default:
+            printf("Error: unsupported OP 0x%X (%d) for randomization\n", r, r);
+            return -1;
+    }
+    extra &= 0x7ff;
+    op |= extra;
+    return op;
+}
+
 
 bool compare( RTL& rtl, DSP16emu& emu ) {
     bool g = true;
@@ -258,7 +525,7 @@ bool compare( RTL& rtl, DSP16emu& emu ) {
     g = g && rtl.j()  == emu.j;
     g = g && rtl.k()  == emu.k;
     // DAU
-    g = g && ( (rtl.psw()&0xfe10) == (emu.psw&0xfe10)); // guard bits are not compared
+    g = g && ( (rtl.psw()&0xfe10) == (emu.get_psw()&0xfe10)); // guard bits are not compared
     g = g && rtl.x()   == emu.x;
     g = g && rtl.y()   == emu.y;
     g = g && rtl.yl()  == emu.yl;
@@ -303,7 +570,7 @@ void dump( RTL& rtl, DSP16emu& emu ) {
     REG_DUMP( K, emu.k,  rtl.k  )
     // DAU
     cout << "-- DAU --\n";
-    REG_DUMP(PSW, emu.psw , rtl.psw )
+    REG_DUMP(PSW, emu.get_psw(), rtl.psw )
     REG_DUMP( X, emu.x , rtl.x  )
     REG_DUMP( Y, emu.y , rtl.y  )
     REG_DUMP(YL, emu.yl, rtl.yl )
@@ -324,130 +591,3 @@ void dump( RTL& rtl, DSP16emu& emu ) {
     cout << "-- STATS --\n";
     printf("%d RAM reads and %d RAM writes\n", emu.stats.ram_reads, emu.stats.ram_writes );
 }
-
-ParseArgs::ParseArgs( int argc, char *argv[]) {
-    extra = step = verbose = playback = tracecmp = allcmd = false;
-    exit = false;
-    error = false;
-    vcd_file="test.vcd";
-    trace_file="wof.tr";
-    write_vcd=false;
-    seed=0;
-    max = 100'000;
-    if( argc==1 ) return;
-    for( int k=1; k<argc; k++ ) {
-        if( argv[k][0]=='-' ) {
-            if( strcmp(argv[k],"-extra")==0 )  { extra=true;  continue; }
-            if( strcmp(argv[k],"-v")==0 ) {
-                verbose=true;
-                if(verbose) step=true;
-                continue;
-            }
-            if( strcmp(argv[k],"-w")==0 ) {
-                write_vcd=true;
-                continue;
-            }
-            if( strcmp(argv[k],"-play")==0 ) {
-                qsnd_rom = "spf2t.rom";
-                playfile = "spf2t_b1.qs";
-                if( k+1 < argc )
-                    qsnd_rom = argv[++k];
-                if( k+1 < argc ) {
-                    playfile = argv[++k];
-                }
-                playback=true;
-                continue;
-            }
-            if( strcmp(argv[k],"-allcmd")==0 ) { allcmd=true; continue; }
-            if( strcmp(argv[k],"-tracecmp")==0 ) { tracecmp=true; continue; }
-            if( strcmp(argv[k],"-max")==0 ) {
-                if( ++k<argc ) {
-                    max = strtol(argv[k], NULL, 0);
-                }
-                continue;
-            }
-            if( strcmp(argv[k],"-mintime")==0 ) {
-                if( ++k < argc )
-                    min_sim_time=atoi(argv[k]);
-                else {
-                    throw runtime_error("Expecting minimum simulation time after -mintime");
-                }
-                continue;
-            }
-            if( strcmp(argv[k],"-vcd")==0 ) {
-                if( ++k < argc )
-                    vcd_file=argv[k];
-                else {
-                    throw runtime_error("Expecting name of VCD file after -vcd");
-                }
-                continue;
-            }
-            if( strcmp(argv[k],"-h")==0 ) {
-                cout <<
-"-play [CPS rom file] [playfile] \n"
-"                      enables playback. The rom file is an MRA output.\n"
-"                      The play file should follow spf2t_b1.qs example\n"
-"-allcmd               parses all command inputs in the file\n"
-"-tracecmp             enables comparative traces\n"
-"-mintime              minimum time simulated\n"
-"-max                  maximum clock tits simulated for random tests\n"
-"-v                    verbose\n"
-"-vcd                  name of output VCD file\n";
-                exit=true;
-                break;
-            }
-            error = true;
-            cout << "Error: cannot recognize argument " << argv[k] << '\n';
-            return;
-        } else {
-            // parse as seed
-            seed = strtol(argv[k], NULL, 0);
-        }
-    }
-    srand(seed);
-    if(!playback && !tracecmp) printf("Random seed = %d\n", seed);
-}
-
-QSCmd::QSCmd( const std::string& fname ) {
-    ifstream fin(fname);
-    if(!fin.good()) {
-        stringstream ss("Cannot open file ");
-        ss << fname;
-        throw runtime_error(ss.str());
-    }
-    string line;
-    bool first=true;
-    int ref_sample=10;
-    int skip=-1;
-    while( !fin.eof() ) {
-        getline(fin, line, '\n');
-        //cout << "0** " << line << "**\n";
-        if( fin.bad() ) {
-            cout << "ERROR: fin is bad\n";
-            break;
-        }
-
-        if( line.find('#')!= string::npos ) {
-            line = line.substr( 0, line.find_first_not_of(" \t#")-2 );
-        }
-        if( !line.size() ) {
-            skip++;
-            continue;
-        }
-        stringstream ss(line);
-        int sample, addr, cmd;
-        ss >> sample >> addr >> cmd;
-        if( first ) {
-            ref_sample = sample;
-            first = false;
-        }
-        decltype(VCDpoint::time) time=(sample-ref_sample)*20'833LL;
-        int val = (addr<<16) | (cmd&0xffff);
-        points.push_back( {time, val} );
-    }
-    // for( auto p : points ) {
-    //     cout << dec << p.time/1000'000 << "ms   " << hex << p.val << "\n";
-    // }
-    cout << "Read " << dec << points.size() << " data points ("<<skip<<" skipped)\n";
-    cout << "Final time=" << points.back().time/1000'000 << "ms\n";
-}
\ No newline at end of file
@@ -0,0 +1,40 @@
+// Converts a MAME text trace to the binary trace format
+// Build with: g++ -O2 tr2bin.cc mametrace.cc -o tr2bin
+//
+// tr2bin input.tr output.trb
+
+#include "mametrace.h"
+#include "snapshot.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+int main( int argc, char *argv[] ) {
+    if( argc<3 ) {
+        cout << "Usage: tr2bin input.tr output.trb\n";
+        return 1;
+    }
+    try {
+        MAMEtrace tr( argv[1] );
+        if( tr.get_line()==0 ) throw runtime_error(string("Cannot read ")+argv[1]);
+        ofstream fout( argv[2], ios_base::binary );
+        SnapWriter w( fout, MAMETRACE_MAGIC, MAMETRACE_VERSION );
+        w.put( (uint32_t)sizeof(CPUstate) );
+        int cnt=0;
+        do {
+            CPUstate st;
+            tr.get_state( st );
+            w.put( st );
+            cnt++;
+        } while( tr.next() );
+        if( !w.good() ) throw runtime_error(string("Cannot write ")+argv[2]);
+        printf("%d trace lines written to %s\n", cnt, argv[2] );
+    } catch( const runtime_error& e ) {
+        printf("ERROR: %s\n",e.what());
+        return 1;
+    }
+    return 0;
+}
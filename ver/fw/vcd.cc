@@ -1,53 +1,98 @@
 #include "vcd.h"
-#include <fstream>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
 VCDfile::VCDfile( const char *fname, int downscale ) {
-    ifstream fin( fname );
-    string str;
+    load( fname, downscale );
+}
+
+VCDfile::VCDfile( const char *fname, const std::vector<std::string>& keep, int downscale ) {
+    wanted.insert( keep.begin(), keep.end() );
+    load( fname, downscale );
+}
+
+void VCDfile::load( const char *fname, int downscale ) {
+    int fd = open( fname, O_RDONLY );
+    if( fd<0 ) throw runtime_error(string("Cannot open VCD file ")+fname);
+    struct stat st;
+    if( fstat( fd, &st )!=0 || st.st_size==0 ) {
+        close(fd);
+        throw runtime_error(string("Cannot read VCD file ")+fname);
+    }
+    size_t len = st.st_size;
+    void *map = mmap( nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close(fd);
+    if( map==MAP_FAILED ) throw runtime_error(string("Cannot map VCD file ")+fname);
+    madvise( map, len, MADV_SEQUENTIAL );
+    const char *s = (const char*)map, *end = s+len;
     line=1;
     scale = downscale;
-    while( getline( fin, str ) ) {
-        string cmd;
-        int blank = str.find_first_of(" \t");
-        cmd = blank ? str.substr(0,blank) : str;
-        try {
-            if( cmd=="$var" ) parse_var(str);
-        } catch( const char *msg ) {
-            char err_msg[256];
-            int len = strlen(msg);
-            strncpy( err_msg, msg, 200 );
-            char *n = err_msg+len;
-            sprintf(n," at line %d.", line );
-            throw err_msg;
+    try {
+        // the header is parsed line by line
+        while( s<end ) {
+            const char *eol = (const char*)memchr( s, '\n', end-s );
+            if( eol==nullptr ) eol=end;
+            string str( s, eol );
+            s = eol<end ? eol+1 : end;
+            string cmd;
+            int blank = str.find_first_of(" \t");
+            cmd = blank ? str.substr(0,blank) : str;
+            try {
+                if( cmd=="$var" ) parse_var(str);
+            } catch( const runtime_error& e ) {
+                throw runtime_error(string(e.what())+" at line "+to_string(line));
+            }
+            if( cmd=="$dumpvars" ) break;
+            line ++;
         }
-        if( cmd=="$dumpvars" ) break;
-        line ++;
+        parse_body( s, end );
+    } catch( ... ) {
+        munmap( map, len );
+        throw;
     }
-    parse_t0( fin );
-    parse_rest( fin );
+    munmap( map, len );
     rewind();
 }
 
+// VCD identifiers use the printable characters from ! to ~. They are
+// read as bijective base 94 numbers, least significant first, so "!"
+// is 0 and "!!" is 94. The codes stay dense for generated identifiers.
+// Identifiers longer than three characters get -1 and are kept by name
+int VCDfile::handle_code( const char *s, const char *end ) {
+    if( end-s<1 ) throw runtime_error("VCD: missing signal identifier");
+    if( end-s>3 ) return -1;
+    int code=0, weight=1;
+    while( s<end ) {
+        code += (*s++ - '!' + 1)*weight;
+        weight *= 94;
+    }
+    return code-1;
+}
+
 void VCDfile::parse_var( const string& str ) {
     char *s = new char[str.size()+1];
-    string handle, name;
+    string type, handle, name;
+    int w=0;
     strcpy( s, str.c_str() );
     char *token = strtok( s, " \t" );
     try{
         // move across the line
         if( strcmp(token,"$var")!=0 ) throw runtime_error("VCD: expecting $var");
         token = strtok(NULL," \t");
-        if( token==NULL || (strcmp(token,"wire")!=0 && strcmp(token,"integer")!=0)
-            ) throw runtime_error("VCD: expecting wire or integer");
+        if( token==NULL ) throw runtime_error("VCD: expecting wire or integer");
+        type = token;
         token = strtok(NULL," \t");
         // Get width
         if( token==NULL ) throw runtime_error("VCD: expecting signal width");
-        int w = atoi( token );
-        if( w<1 || w>64 ) throw runtime_error("VCD: signal width not supported");
+        w = atoi( token );
         token = strtok(NULL," \t");
         // Get handle
         if( token==NULL ) throw runtime_error("VCD: expecting signal token");
@@ -56,63 +101,107 @@ void VCDfile::parse_var( const string& str ) {
         // Get full name
         if( token==NULL ) throw runtime_error("VCD: expecting signal name");
         name = token;
-        // Create signal
-        const int64_t mask = w==64 ? ~0L : (1L<<w)-1;
-        VCDsignal *sig = new VCDsignal( name, mask );
-        signals[name] = sig;
-        handlers[handle] = sig;
         delete[] s;
         s = nullptr;
     } catch( ... ) {
         delete[] s;
         throw;
     }
+    // Signals that were not asked for are skipped, whatever their type.
+    // Their identifier is still declared, so its value changes are ignored
+    if( !wanted.empty() && wanted.count(name)==0 ) {
+        add_handler( handle, nullptr );
+        return;
+    }
+    if( type!="wire" && type!="integer" ) throw runtime_error("VCD: expecting wire or integer");
+    if( w<1 || w>64 ) throw runtime_error("VCD: signal width not supported");
+    // Create signal
+    const int64_t mask = w==64 ? ~0L : (1L<<w)-1;
+    VCDsignal *sig = new VCDsignal( name, mask );
+    signals[name] = sig;
+    add_handler( handle, sig );
 }
 
-void VCDfile::parse_value( int64_t t, const string& str ) {
-    string handler;
-    int64_t v;
-    if( str.at(0)=='b' ) {
-        v=parse_bin(str.substr(1));
-        handler = str.substr( str.find_first_of(' ')+1 );
-    } else {
-        v = str.at(0)=='1';
-        handler = str.substr(1);
+// An identifier declared twice, as for aliased nets, keeps the last signal
+void VCDfile::add_handler( const string& handle, VCDsignal *sig ) {
+    int code = handle_code( handle.c_str(), handle.c_str()+handle.size() );
+    if( code<0 ) {
+        auto k = long_handlers.find( handle );
+        if( k==long_handlers.end() || sig!=nullptr ) long_handlers[handle] = sig;
+        return;
+    }
+    if( code >= (int)handlers.size() ) {
+        handlers.resize( code+1, nullptr );
+        declared.resize( code+1, false );
     }
-    handlers[handler]->push( t/scale, v );
+    declared[code] = true;
+    if( sig!=nullptr ) handlers[code] = sig;
 }
 
-void VCDfile::parse_t0( ifstream& fin ) {
-    string str;
-    while( getline( fin, str ) ) {
-        if( str.find_first_of("$end")==0 ) { line++; return; }
-        parse_value( 0, str );
-        line++;
-    };
+// s points to the start of a value change line, without the line end.
+// The identifier is looked up first, so skipped signals cost no parsing
+void VCDfile::parse_value( int64_t t, const char *s, const char *end ) {
+    const char *id;
+    if( *s=='b' || *s=='B' ) {
+        id = (const char*)memchr( s, ' ', end-s );
+        if( id==nullptr ) id=end;
+        while( id<end && *id==' ' ) id++;
+    } else if( *s=='r' || *s=='R' ) {
+        return; // real values are not supported
+    } else {
+        id = s+1;
+    }
+    int code = handle_code( id, end );
+    VCDsignal *sig = nullptr;
+    bool known;
+    if( code<0 ) {
+        auto k = long_handlers.find( string( id, end ) );
+        known = k!=long_handlers.end();
+        if( known ) sig = k->second;
+    } else {
+        known = code < (int)handlers.size() && declared[code];
+        if( known ) sig = handlers[code];
+    }
+    if( !known ) {
+        char msg[256];
+        sprintf(msg, "VCD: unknown signal identifier at line %d", line );
+        throw runtime_error(msg);
+    }
+    if( sig==nullptr ) return;
+    int64_t v=0;
+    if( *s=='b' || *s=='B' ) {
+        for( s++; s<end && *s!=' '; s++ ) {
+            v<<=1;
+            if( *s=='1' ) v|=1;
+        }
+    } else {
+        v = *s=='1';
+    }
+    sig->push( t/scale, v );
 }
 
-void VCDfile::parse_rest( ifstream& fin ) {
-    string str;
+// Values after $dumpvars and before the first time mark are at time zero
+void VCDfile::parse_body( const char *s, const char *end ) {
     int64_t t=0L;
-    while( getline( fin, str ) ) {
-        if( str.at(0)=='#' ) {
-            sscanf( str.c_str()+1, "%ld", &t );
-        } else parse_value( t, str );
+    while( s<end ) {
+        const char *eol = (const char*)memchr( s, '\n', end-s );
+        if( eol==nullptr ) eol=end;
+        const char *next = eol<end ? eol+1 : end;
+        while( eol>s && (eol[-1]=='\r' || eol[-1]==' ') ) eol--;
+        if( s<eol ) {
+            if( *s=='#' ) {
+                t = 0;
+                for( s++; s<eol && *s>='0' && *s<='9'; s++ )
+                    t = t*10 + (*s-'0');
+            } else if( *s!='$' ) {
+                parse_value( t, s, eol );
+            }
+        }
+        s = next;
         line++;
     };
 }
 
-int64_t VCDfile::parse_bin( const string& str) {
-    int64_t v=0;
-    const char *c = str.c_str();
-    while(*c!=' ') {
-        v<<=1;
-        if( *c=='1' ) v|=1;
-        c++;
-    }
-    return v;
-}
-
 VCDfile::~VCDfile() {
     for( auto k : signals ) {
         delete k.second;
@@ -171,48 +260,54 @@ void VCDfile::report() {
 VCDsignal::VCDsignal( const std::string& _name, int64_t _mask ) {
     name = _name;
     mask = _mask;
-    k = points.end();
-    n = points.end();
+    k = 0;
+    ended = false;
 }
 
 void VCDsignal::push( int64_t time, int64_t val ) {
-    VCDpoint pt;
-    pt.time = time;
-    pt.val = val;
-    points.push_back( pt );
+    times.push_back( time );
+    vals.push_back( val );
 }
 
 void VCDsignal::rewind() {
-    k = points.begin();
-    n = k; n++;
+    k = 0;
 }
 
+// moves to the first point at or after the given time, or to the last one
 int64_t VCDsignal::forward( int64_t time ) {
-    static bool ended=false;
-    while( time > k->time && n!=points.end() ) {
-        k++;
-        n++;
-    }
-    if(n==points.end() && !ended) {
-        printf("%s passed end\n", name.c_str());
-        ended=true;
+    if( times.empty() ) return 0;
+    auto p = lower_bound( times.begin()+k, times.end(), time );
+    k = p - times.begin();
+    if( k>=times.size()-1 ) {
+        k = times.size()-1;
+        if( !ended ) {
+            printf("%s passed end\n", name.c_str());
+            ended=true;
+        }
+        return times[k];
     }
-    return n==points.end() ? k->time : n->time;
+    return times[k+1];
 }
 
 int64_t VCDsignal::get_tend() {
-    return points.back().time;
+    return times.empty() ? 0 : times.back();
 }
 
 int64_t VCDsignal::cur() {
-    return k->val;
+    return vals[k];
 }
 
 int64_t VCDsignal::next(int64_t val) {
     val &= mask;
-    while( k->val != val && n!=points.end() ) {
-        k++;
-        n++;
+    while( vals[k] != val && k+1<vals.size() ) k++;
+    return times[k];
+}
+
+VCDsignal::pointlist VCDsignal::get_list() const {
+    pointlist l( times.size() );
+    for( size_t j=0; j<times.size(); j++ ) {
+        l[j].time = times[j];
+        l[j].val  = vals[j];
     }
-    return k->time;
-}
\ No newline at end of file
+    return l;
+}
@@ -1,9 +1,11 @@
 #ifndef __VCDPARSE_H
 #define __VCDPARSE_H
 
-#include <list>
+#include <cstdint>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 struct VCDpoint {
     int64_t time, val;
@@ -12,11 +14,13 @@ struct VCDpoint {
 
 class VCDsignal {
 public:
-    using pointlist=std::list<VCDpoint>;
+    using pointlist=std::vector<VCDpoint>;
 private:
-    pointlist points;
-    pointlist::iterator k, n;
+    // columnar storage, times are in increasing order
+    std::vector<int64_t> times, vals;
+    size_t k; // current point
     int64_t mask;
+    bool ended;
     std::string name;
 public:
     VCDsignal( const std::string& _name, int64_t _mask );
@@ -26,23 +30,29 @@ public:
     int64_t next(int64_t val);
     int64_t cur();
     int64_t get_tend();
-    //int64_t time() { return k->time; }
-    int data_points() { return points.size(); }
-    const pointlist& get_list() const { return points; }
+    int data_points() { return times.size(); }
+    pointlist get_list() const;
 };
 
 class VCDfile {
     typedef std::map<std::string,VCDsignal*> sigmap;
-    sigmap signals, handlers;
+    sigmap signals;
+    std::vector<VCDsignal*> handlers; // indexed by the identifier code
+    std::vector<bool> declared;       // false for unknown identifiers
+    sigmap long_handlers;             // identifiers too long for a code
+    std::set<std::string> wanted;     // signals to keep, empty for all
+    void load( const char *fname, int downscale );
     void parse_var  ( const std::string& str );
-    void parse_value( int64_t t, const std::string& str );
-    void parse_t0   ( std::ifstream& fin );
-    void parse_rest ( std::ifstream& fin );
-    int64_t parse_bin( const std::string& );
+    void parse_value( int64_t t, const char *s, const char *end );
+    void parse_body ( const char *s, const char *end );
+    int handle_code( const char *s, const char *end );
+    void add_handler( const std::string& handle, VCDsignal *sig );
     VCDsignal* get_or_throw( const std::string& name );
     int line, scale;
 public:
     VCDfile( const char *fname, int downscale=1000 ); // scale from ps to ns
+    // only the signals named in keep are loaded
+    VCDfile( const char *fname, const std::vector<std::string>& keep, int downscale=1000 );
     VCDsignal* get_signal( const char *name );
     ~VCDfile();
     // move all signals
@@ -53,4 +63,4 @@ public:
     void report();
 };
 
-#endif
\ No newline at end of file
+#endif